@@ -0,0 +1,341 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "defines.h"
+#include "Display.h"
+
+Display::Display() :
+  spi_handle       { NULL },
+  active           { 0 },
+  length           { 0 },
+  is_busy          { false },
+  task             { NULL },
+  shadow_color     { },
+  is_clear_pending { false },
+  color            { },
+  updates          { 0 },
+  bytes            { 0 },
+  full_bytes       { 0 }
+{
+  memset(shadow, ' ', sizeof(shadow));
+  memset(frame,  ' ', sizeof(frame));
+  memset(screen, ' ', sizeof(screen));
+
+  buffers[0] = NULL;
+  buffers[1] = NULL;
+
+  pthread_mutex_init(&lock, NULL);
+}
+
+Display::~Display()
+{
+  if (task != NULL) { vTaskDelete(task); }
+
+  wait();
+
+  pthread_mutex_destroy(&lock);
+
+  if (buffers[0] != NULL) { heap_caps_free(buffers[0]); }
+  if (buffers[1] != NULL) { heap_caps_free(buffers[1]); }
+}
+
+int Display::start()
+{
+  for (int i = 0; i < 2; i++)
+  {
+    buffers[i] = (uint8_t *)heap_caps_malloc(BUFFER_SIZE, MALLOC_CAP_DMA);
+
+    if (buffers[i] == NULL)
+    {
+      ESP_LOGE("display", "Can't allocate DMA buffer.");
+      return -1;
+    }
+  }
+
+  spi_init();
+
+  // Same priority as the game loop, below the network and audio tasks.
+  if (xTaskCreate(display_task, "display", 3072, this, 1, &task) != pdPASS)
+  {
+    ESP_LOGE("display", "Can't create task.");
+    return -1;
+  }
+
+  return 0;
+}
+
+void Display::display_task(void *context)
+{
+  Display *display = (Display *)context;
+  const TickType_t frame_ticks = pdMS_TO_TICKS(FRAME_MS);
+  TickType_t last_draw = xTaskGetTickCount() - frame_ticks;
+
+  while (true)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    // The first change after a quiet spell is drawn right away. In a
+    // burst the rest wait for the next frame and are drawn together.
+    TickType_t elapsed = xTaskGetTickCount() - last_draw;
+
+    if (elapsed < frame_ticks)
+    {
+      vTaskDelay(frame_ticks - elapsed);
+    }
+
+    // Whatever was flushed while waiting is in this frame already.
+    ulTaskNotifyTake(pdTRUE, 0);
+
+    display->draw();
+
+    last_draw = xTaskGetTickCount();
+  }
+}
+
+void Display::spi_init()
+{
+  spi_bus_config_t spi_bus_config = { };
+  spi_bus_config.sclk_io_num     = GPIO_SPI_SCK;
+  spi_bus_config.mosi_io_num     = GPIO_SPI_DO;
+  spi_bus_config.miso_io_num     = GPIO_SPI_DI;
+#if 0
+  spi_bus_config.data0_io_num    = -1;
+  spi_bus_config.data1_io_num    = -1;
+  spi_bus_config.data2_io_num    = -1;
+  spi_bus_config.data3_io_num    = -1;
+  spi_bus_config.data4_io_num    = -1;
+  spi_bus_config.data5_io_num    = -1;
+  spi_bus_config.data6_io_num    = -1;
+  spi_bus_config.data7_io_num    = -1;
+#endif
+  spi_bus_config.quadwp_io_num   = -1;
+  spi_bus_config.quadhd_io_num   = -1;
+  spi_bus_config.max_transfer_sz = BUFFER_SIZE;
+
+  spi_bus_initialize(SPI2_HOST, &spi_bus_config, SPI_DMA_CH_AUTO);
+
+  spi_device_interface_config_t spi_dev_config = { };
+  spi_dev_config.spics_io_num   = GPIO_SPI_CS;
+  spi_dev_config.command_bits   = 0;
+  spi_dev_config.address_bits   = 0;
+  spi_dev_config.mode           = 0;
+  spi_dev_config.queue_size     = 2;
+  //spi_dev_config.clock_source   = SPI_CLK_SRC_DEFAULT;
+  spi_dev_config.clock_speed_hz = 100000;
+
+  spi_bus_add_device(SPI2_HOST, &spi_dev_config, &spi_handle);
+}
+
+void Display::put(uint8_t ch)
+{
+  // Doesn't happen with a 4x20 screen, but an update that doesn't fit
+  // just goes out in two transactions.
+  if (length == BUFFER_SIZE) { transmit(); }
+
+  buffers[active][length++] = ch;
+}
+
+void Display::put_cursor(int row, int column)
+{
+  // 254, 128 + DDRAM address.
+  put(0xfe);
+  put(0x80 + ROW_ADDRESS[row] + column);
+}
+
+void Display::transmit()
+{
+  if (length == 0) { return; }
+
+  // Only one transaction is on the bus at a time. It's almost always
+  // finished long before the next update is ready.
+  wait();
+
+  spi_transaction_t &transaction = transactions[active];
+
+  memset(&transaction, 0, sizeof(transaction));
+  transaction.length    = length * 8;
+  transaction.tx_buffer = buffers[active];
+
+  esp_err_t result =
+    spi_device_queue_trans(spi_handle, &transaction, portMAX_DELAY);
+
+  if (result == ESP_OK) { is_busy = true; }
+
+  // The next update goes in the other buffer.
+  active = active ^ 1;
+  length = 0;
+}
+
+void Display::wait()
+{
+  if (! is_busy) { return; }
+
+  spi_transaction_t *transaction;
+
+  spi_device_get_trans_result(spi_handle, &transaction, portMAX_DELAY);
+
+  is_busy = false;
+}
+
+void Display::clear()
+{
+  pthread_mutex_lock(&lock);
+  memset(shadow, ' ', sizeof(shadow));
+  is_clear_pending = true;
+  pthread_mutex_unlock(&lock);
+}
+
+void Display::set_color(const Color &color)
+{
+  pthread_mutex_lock(&lock);
+  shadow_color = color;
+  pthread_mutex_unlock(&lock);
+}
+
+void Display::set_screen(const char text[ROWS][COLUMNS])
+{
+  pthread_mutex_lock(&lock);
+  memcpy(shadow, text, sizeof(shadow));
+  pthread_mutex_unlock(&lock);
+}
+
+void Display::flush()
+{
+  if (task != NULL) { xTaskNotifyGive(task); }
+}
+
+int Display::draw()
+{
+  Color wanted;
+  bool is_clear;
+
+  pthread_mutex_lock(&lock);
+  memcpy(frame, shadow, sizeof(frame));
+  wanted = shadow_color;
+  is_clear = is_clear_pending;
+  is_clear_pending = false;
+  pthread_mutex_unlock(&lock);
+
+  if (is_clear)
+  {
+    // 0x7c, 0x2d: Clear.
+    put('|');
+    put(0x2d);
+
+    memset(screen, ' ', sizeof(screen));
+  }
+
+  // Nothing to send until a color is set, the bytes start with '|'.
+  if (wanted.bytes[0] != 0 &&
+      memcmp(wanted.bytes, color.bytes, sizeof(color.bytes)) != 0)
+  {
+    for (int i = 0; i < (int)sizeof(wanted.bytes); i++)
+    {
+      put(wanted.bytes[i]);
+    }
+
+    color = wanted;
+  }
+
+  return send_changes();
+}
+
+int Display::send_changes()
+{
+  // Anything already waiting (a clear or a color change) goes out in the
+  // same transaction.
+  int count = length;
+  int full = 2;
+
+  for (int row = 0; row < ROWS; row++)
+  {
+    const char *want = frame[row];
+    char *have = screen[row];
+
+    // What the old clear and redraw sent for this row: the text without
+    // trailing spaces and a '\r' to get to the next row.
+    int length = COLUMNS;
+    while (length > 0 && want[length - 1] == ' ') { length--; }
+    full += length + (row < ROWS - 1 ? 1 : 0);
+
+    int column = 0;
+    int cursor = -1;
+
+    while (column < COLUMNS)
+    {
+      if (want[column] == have[column])
+      {
+        column++;
+        continue;
+      }
+
+      // The LCD moves the cursor along after each character, so a run
+      // that starts where the last one ended needs no cursor command.
+      if (cursor != column)
+      {
+        if (cursor != -1 && column - cursor <= CURSOR_COST)
+        {
+          while (cursor < column)
+          {
+            put(want[cursor++]);
+            count++;
+          }
+        }
+          else
+        {
+          put_cursor(row, column);
+          count += 2;
+        }
+      }
+
+      put(want[column]);
+      have[column] = want[column];
+      count++;
+
+      column++;
+      cursor = column;
+    }
+  }
+
+  transmit();
+
+  if (count != 0)
+  {
+    updates++;
+    bytes += count;
+    full_bytes += full;
+
+    ESP_LOGD("display", "Update %d: %d bytes (redraw %d).",
+      (int)updates, count, full);
+
+    if (updates % BENCHMARK_UPDATES == 0)
+    {
+      ESP_LOGI("display", "%d updates: %d bytes each vs %d for a redraw.",
+        (int)updates,
+        (int)(bytes / updates),
+        (int)(full_bytes / updates));
+    }
+  }
+
+  return count;
+}
+
+const uint8_t Display::ROW_ADDRESS[ROWS] = { 0x00, 0x40, 0x14, 0x54 };
+
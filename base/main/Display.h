@@ -0,0 +1,134 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/spi_master.h"
+#include "driver/spi_common.h"
+
+// SparkFun SerLCD (20x4) on SPI. Text is written into a shadow copy of
+// the screen and flush() only sends the cells that differ from what the
+// LCD is already showing, moving the cursor to each changed run instead
+// of clearing and redrawing everything.
+//
+// Commands are collected in a DMA buffer and go out as one queued SPI
+// transaction (with the hardware driving CS) when flush() is called.
+// There are two buffers so the next update can be built while the last
+// one is still on the bus.
+//
+// The LCD is only written from the display task. The methods below just
+// record the latest screen and color wanted and flush() wakes the task,
+// so the caller never waits on SPI. Changes that come in faster than
+// FRAME_MS are drawn together in the next frame.
+class Display
+{
+public:
+  static const int ROWS = 4;
+  static const int COLUMNS = 20;
+
+  Display();
+  ~Display();
+
+  // The SerLCD backlight commands for a color: '|' followed by the red,
+  // green and blue levels (0 to 29) offset into their command ranges.
+  struct Color
+  {
+    uint8_t bytes[6];
+  };
+
+  static constexpr Color rgb(int r, int g, int b)
+  {
+    if (r > 29) { r = 29; }
+    if (g > 29) { g = 29; }
+    if (b > 29) { b = 29; }
+
+    return Color
+    {{
+      '|', (uint8_t)(0x80 + r),
+      '|', (uint8_t)(0x9e + g),
+      '|', (uint8_t)(0xbc + b)
+    }};
+  }
+
+  int start();
+
+  // All of these take effect with the next flush().
+  void clear();
+  void set_color(const Color &color);
+
+  // Replaces the whole screen.
+  void set_screen(const char text[ROWS][COLUMNS]);
+
+  // Doesn't block, the display task draws the change.
+  void flush();
+
+private:
+  static void display_task(void *context);
+  int draw();
+  int send_changes();
+  void spi_init();
+  void put(uint8_t ch);
+  void put_cursor(int row, int column);
+  void transmit();
+  void wait();
+
+  spi_device_handle_t spi_handle;
+  spi_transaction_t transactions[2];
+  uint8_t *buffers[2];
+  int active;
+  int length;
+  bool is_busy;
+
+  TaskHandle_t task;
+
+  // What the caller wants on the screen, under lock.
+  pthread_mutex_t lock;
+  char shadow[ROWS][COLUMNS];
+  Color shadow_color;
+  bool is_clear_pending;
+
+  // Only used by the display task: the frame being drawn and what the
+  // LCD is showing.
+  char frame[ROWS][COLUMNS];
+  char screen[ROWS][COLUMNS];
+  Color color;
+
+  // For comparing against clearing and redrawing the whole screen.
+  uint32_t updates;
+  uint32_t bytes;
+  uint32_t full_bytes;
+
+  // A changed run this close to the previous one is cheaper to send
+  // along with the cells in between than with another cursor command.
+  static const int CURSOR_COST = 2;
+
+  // More than a full redraw with a clear and a color change.
+  static const int BUFFER_SIZE = 128;
+
+  // Updates between byte count log lines.
+  static const int BENCHMARK_UPDATES = 100;
+
+  // At most 10 frames a second, a full redraw takes about 8ms at 100kHz.
+  static const int FRAME_MS = 100;
+
+  static const uint8_t ROW_ADDRESS[ROWS];
+};
+
+#endif
+
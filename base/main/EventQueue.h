@@ -0,0 +1,184 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <stdint.h>
+#include <atomic>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Fixed size queue of game inputs. Any number of producers (the network
+// thread, the Bluetooth callback, an ISR) push() and the game loop is the
+// only one to pop(). Each cell has a sequence number so a producer claims
+// a cell with one compare and swap and publishes it with one store, there
+// is no lock for an ISR to get stuck on. When the queue is full the new
+// event is dropped and counted by type. Every push() also wakes the
+// consumer task so it can block until there is something to do.
+class EventQueue
+{
+public:
+  EventQueue() : tail { 0 }, head { 0 }, consumer { NULL }
+  {
+    for (uint32_t i = 0; i < SIZE; i++)
+    {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    for (int i = 0; i < EVENT_TYPES; i++)
+    {
+      dropped[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  enum
+  {
+    // value is the player (1 to MAX_PLAYERS), source the tee connection.
+    EVENT_START_PLAYER,
+    // The ball stopped after moving, source is the beacon (player - 1).
+    EVENT_STROKE,
+    // The hole switch closed.
+    EVENT_HOLE,
+    EVENT_TYPES
+  };
+
+  struct Event
+  {
+    uint8_t type;
+    int8_t source;
+    int16_t value;
+    int64_t timestamp;
+  };
+
+  // Safe from an ISR. Returns false if the queue was full.
+  bool push(const Event &event)
+  {
+    uint32_t position = tail.load(std::memory_order_relaxed);
+    Cell *cell;
+
+    while (true)
+    {
+      cell = &cells[position % SIZE];
+
+      uint32_t sequence = cell->sequence.load(std::memory_order_acquire);
+      int32_t diff = (int32_t)(sequence - position);
+
+      if (diff == 0)
+      {
+        if (tail.compare_exchange_weak(
+          position,
+          position + 1,
+          std::memory_order_relaxed))
+        {
+          break;
+        }
+      }
+        else
+      if (diff < 0)
+      {
+        // The consumer hasn't taken the event SIZE places back yet.
+        if (event.type < EVENT_TYPES)
+        {
+          dropped[event.type].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        return false;
+      }
+        else
+      {
+        position = tail.load(std::memory_order_relaxed);
+      }
+    }
+
+    cell->event = event;
+    cell->sequence.store(position + 1, std::memory_order_release);
+
+    notify();
+
+    return true;
+  }
+
+  bool push(int type, int source, int value, int64_t timestamp)
+  {
+    Event event;
+
+    event.type      = type;
+    event.source    = source;
+    event.value     = value;
+    event.timestamp = timestamp;
+
+    return push(event);
+  }
+
+  // The task that calls pop(), it waits with ulTaskNotifyTake().
+  void set_consumer(TaskHandle_t task) { consumer = task; }
+
+  // Wakes the consumer without an event, for example from a timer.
+  void notify()
+  {
+    if (consumer == NULL) { return; }
+
+    if (xPortInIsrContext())
+    {
+      BaseType_t woken = pdFALSE;
+      vTaskNotifyGiveFromISR(consumer, &woken);
+      portYIELD_FROM_ISR(woken);
+    }
+      else
+    {
+      xTaskNotifyGive(consumer);
+    }
+  }
+
+  // Only from the consumer. Returns false if the queue is empty.
+  bool pop(Event &event)
+  {
+    Cell &cell = cells[head % SIZE];
+
+    uint32_t sequence = cell.sequence.load(std::memory_order_acquire);
+
+    if ((int32_t)(sequence - (head + 1)) < 0) { return false; }
+
+    event = cell.event;
+    cell.sequence.store(head + SIZE, std::memory_order_release);
+    head++;
+
+    return true;
+  }
+
+  uint32_t get_dropped(int type)
+  {
+    return dropped[type].load(std::memory_order_relaxed);
+  }
+
+  // Must be a power of 2 so the positions can wrap around.
+  static const uint32_t SIZE = 32;
+
+private:
+  struct Cell
+  {
+    std::atomic<uint32_t> sequence;
+    Event event;
+  };
+
+  Cell cells[SIZE];
+  std::atomic<uint32_t> tail;
+  uint32_t head;
+  std::atomic<uint32_t> dropped[EVENT_TYPES];
+  TaskHandle_t consumer;
+};
+
+#endif
+
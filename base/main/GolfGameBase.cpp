@@ -20,416 +20,595 @@
 #include "driver/gptimer.h"
 #include "driver/gpio.h"
 #include "driver/gptimer.h"
-#include "driver/ledc.h"
-#include "driver/spi_common.h"
 #include "soc/gpio_reg.h"
 #include "esp_flash.h"
 #include "esp_log.h"
 #include "esp_task_wdt.h"
-#include "rom/ets_sys.h"
+#include "esp_timer.h"
 
 #include "defines.h"
 #include "GolfGameBase.h"
 #include "NanoBeacon.h"
 #include "NetworkServer.h"
 
-GolfGameBase::GolfGameBase()
+GolfGameBase::GolfGameBase() :
+  active_count  { 0 },
+  waiting_first { 0 },
+  waiting_count { 0 },
+  hole_count    { 0 },
+  last_holed    { -1 },
+  hole_glitches { 0 },
+  hole_ignored  { 0 },
+  status_timer  { NULL }
 {
   memset(hits, 0, sizeof(hits));
+  memset(active, -1, sizeof(active));
+  memset(waiting, 0, sizeof(waiting));
+  memset(strokes, 0, sizeof(strokes));
+  memset(start_time, 0, sizeof(start_time));
+  memset(stroke_time, 0, sizeof(stroke_time));
+  memset(idle_since, 0, sizeof(idle_since));
+  memset(hole_times, 0, sizeof(hole_times));
+  memset(dropped, 0, sizeof(dropped));
 }
 
 GolfGameBase::~GolfGameBase()
 {
+  if (status_timer != NULL)
+  {
+    esp_timer_stop(status_timer);
+    esp_timer_delete(status_timer);
+  }
 }
 
 void GolfGameBase::run()
 {
-  NetworkServer server;
+  // Set before anything can push so no wake up is missed.
+  events.set_consumer(xTaskGetCurrentTaskHandle());
+
+  // Static since its connection pools, status page and score stream
+  // buffers don't fit on the default 3.5K main task stack.
+  static NetworkServer server(events);
 
   server.start();
 
   gpio_init();
 
-  spi_init();
-  display_clear();
-  display_set_color(29, 0, 0);
+  // After gpio_init() since LEDC takes over the speaker pin.
+  speaker.start(GPIO_SPEAKER);
+
+  display.start();
+  display.clear();
+  display_set_color(COLOR_DISCONNECTED);
   display_update(-1);
 
-  NanoBeacon beacon;
+  NanoBeacon beacon(events);
 
-  int current_player = -1;
-  int hits = -1;
-  bool is_connected = false;
+  esp_timer_create_args_t timer_args = { };
+  timer_args.callback = on_status_timer;
+  timer_args.arg      = this;
+  timer_args.name     = "status";
+
+  ESP_ERROR_CHECK(esp_timer_create(&timer_args, &status_timer));
+  ESP_ERROR_CHECK(esp_timer_start_periodic(
+    status_timer,
+    (uint64_t)STATUS_INTERVAL_MS * 1000));
 
   while (true)
   {
-    vTaskDelay(1000 / portTICK_PERIOD_MS);
+    // Sleeps until a tee, a beacon, the hole or the status timer has
+    // something. Several wake ups are handled by one pass.
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    // Everything that happened since the last time through, in order.
+    // Nothing is lost if two taps or strokes land in the same second.
+    EventQueue::Event event;
 
-    // Check if connection status changed so the color of the board
-    // can be changed.
-    if (is_connected)
+    while (events.pop(event))
     {
-      if (server.is_connected() == false)
+      if (event.type == EventQueue::EVENT_START_PLAYER)
       {
-        display_set_color(29, 0, 0);
-        display_update(hits);
-        is_connected = false;
+        int player_index = event.value - 1;
+
+        if (player_index < 0 || player_index >= MAX_PLAYERS) { continue; }
+
+        ESP_LOGI(TAG, "Player %d tapped in at tee %d.",
+          player_index, event.source);
+
+        player_check_in(player_index, event.timestamp);
       }
-    }
-      else
-    {
-      if (server.is_connected() == true)
+        else
+      if (event.type == EventQueue::EVENT_STROKE)
       {
-        if (current_player == -1)
-        {
-          display_set_color(0, 0, 29);
-        }
-          else
+        // The beacon is the player. Balls of players not on the hole
+        // don't count.
+        int player_index = event.source;
+
+        if (player_slot(player_index) < 0) { continue; }
+        if (event.timestamp < start_time[player_index]) { continue; }
+
+        // The ball just went still. If it last moved when a ball
+        // dropped it's the one in the cup, and the hole counts the putt.
+        int hole = hole_find(player_index);
+
+        if (hole != -1)
         {
-          display_set_color(0, 29, 0);
+          hole_in(hole, player_index);
+          continue;
         }
 
-        display_update(hits);
-        is_connected = true;
+        stroke_time[player_index] = event.timestamp;
+        idle_since[player_index] = esp_timer_get_time();
+        strokes[player_index]++;
+
+        ESP_LOGI(TAG, "player=%d strokes=%d",
+          player_index, strokes[player_index]);
+
+        play_song_hit();
+      }
+        else
+      if (event.type == EventQueue::EVENT_HOLE)
+      {
+        hole_add(event.timestamp);
       }
     }
 
-    int player = server.get_player();
-    int player_index = player - 1;
+    int64_t now = esp_timer_get_time();
+
+    hole_expire(now);
+
+    // Anyone who walked off frees their place for the next in line.
 
-    if (player != 0 && player_index != current_player)
+    for (int i = 0; i < MAX_ACTIVE_PLAYERS; i++)
     {
-      ESP_LOGI(TAG, "New player %d (current=%d).", player_index, current_player);
+      int player_index = active[i];
 
-      current_player = player_index;
-      display_set_color(0, 29, 0);
-      hits = 0;
-      display_update(hits);
+      if (player_index < 0) { continue; }
 
-      play_song_begin();
+      if (now - idle_since[player_index] > (int64_t)PLAYER_IDLE_MS * 1000)
+      {
+        ESP_LOGI(TAG, "Player %d idle, giving up their place.",
+          player_index);
+
+        player_finish(i, -1);
+      }
     }
 
-    if (current_player >= 0)
+    // The display task only draws what changed and skips a color that
+    // is already showing, so this is cheap to do every pass.
+    int current = current_player();
+
+    if (! server.is_connected())
     {
-      if (gpio_get_level(GPIO_HOLE) == 0)
-      {
-        hits++;
-        this->hits[current_player] = hits;
-        current_player = -1;
-        display_set_color(0, 0, 29);
-        display_update();
-        play_song_finish();
+      display_set_color(COLOR_DISCONNECTED);
+    }
+      else
+    if (active_count != 0)
+    {
+      display_set_color(COLOR_PLAYING);
+    }
+      else
+    {
+      display_set_color(COLOR_IDLE);
+    }
 
-      }
-        else
-      if (NanoBeacon::rotations[current_player].flags != 0)
+    display_update(current >= 0 ? strokes[current] : -1);
+
+    for (int i = 0; i < EventQueue::EVENT_TYPES; i++)
+    {
+      uint32_t count = events.get_dropped(i);
+
+      if (count != dropped[i])
       {
-        NanoBeacon::rotations[current_player].clear_flags = true;
+        ESP_LOGW(TAG, "Event queue full, %d events of type %d dropped.",
+          (int)(count - dropped[i]), i);
+        dropped[i] = count;
+      }
+    }
 
-        hits++;
+    // Closures too short to be a ball, and drops in the lockout after
+    // another one.
+    uint32_t glitches = hole.get_glitches();
+    uint32_t ignored = hole.get_ignored();
 
-        ESP_LOGI(TAG, "current_player=%d hits=%d", current_player, hits);
+    if (glitches != hole_glitches || ignored != hole_ignored)
+    {
+      ESP_LOGI(TAG, "Hole switch: %d glitches, %d closures ignored.",
+        (int)glitches, (int)ignored);
 
-        display_update(hits);
-        play_song_hit();
-      }
+      hole_glitches = glitches;
+      hole_ignored = ignored;
+    }
+
+    server.set_hole_counts(glitches, ignored);
+
+    // Keep the status page up to date. The server ignores values that
+    // didn't change so this doesn't re-render the page every time.
+    uint32_t now_ms = now / 1000;
+
+    for (int i = 0; i < MAX_PLAYERS; i++)
+    {
+      uint32_t last_seen = NanoBeacon::beacons.last_seen_ms[i].load();
+
+      server.set_score(i + 1, this->hits[i]);
+      server.set_beacon_alive(i,
+        last_seen != 0 && now_ms - last_seen < BEACON_TIMEOUT_MS);
     }
 
+    server.set_current_player(
+      current + 1,
+      current >= 0 ? strokes[current] : 0);
+
     //gpio_set_level(GPIO_OUTPUT_IO_19, count % 2);
     //count++;
   }
 }
 
-void GolfGameBase::gpio_init()
+void GolfGameBase::player_check_in(int player, int64_t timestamp)
 {
-  // Zero-initialize the config structure.
-  gpio_config_t io_conf = { };
+  if (player_slot(player) >= 0) { return; }
 
-  // Set GPIO_NUM_4 as input with pullup.
-  memset(&io_conf, 0, sizeof(io_conf));
-  io_conf.intr_type    = GPIO_INTR_DISABLE;
-  io_conf.mode         = GPIO_MODE_INPUT;
-  io_conf.pin_bit_mask = (1ULL << GPIO_HOLE);
-  io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
-  io_conf.pull_up_en   = GPIO_PULLUP_ENABLE;
-  gpio_config(&io_conf);
+  for (int i = 0; i < waiting_count; i++)
+  {
+    if (waiting[(waiting_first + i) % MAX_PLAYERS] == player) { return; }
+  }
 
-  // Setup SPI chip select.
-  memset(&io_conf, 0, sizeof(io_conf));
-  io_conf.intr_type    = GPIO_INTR_DISABLE;
-  io_conf.mode         = GPIO_MODE_OUTPUT;
-  io_conf.pin_bit_mask =
-    (1ULL << GPIO_SPEAKER) |
-    (1ULL << GPIO_SPI_CS)  |
-    (1ULL << GPIO_SPI_SCK) |
-    (1ULL << GPIO_SPI_DO);
-  io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
-  io_conf.pull_up_en   = GPIO_PULLUP_DISABLE;
+  if (active_count < MAX_ACTIVE_PLAYERS)
+  {
+    player_start(player, timestamp);
+    return;
+  }
 
-  gpio_config(&io_conf);
+  // A player is never both on the hole and in line, so there's room.
+  waiting[(waiting_first + waiting_count) % MAX_PLAYERS] = player;
+  waiting_count++;
 
-  // GPIO_NUM_0: Speaker.
-  // GPIO_NUM_4: /CS
-  // GPIO_NUM_5: DI
-  // GPIO_NUM_6: SCK
-  // GPIO_NUM_7: DO
-  gpio_set_level(GPIO_SPEAKER, 0);
-  gpio_set_level(GPIO_SPI_CS,  1);
-  gpio_set_level(GPIO_SPI_DI,  0);
-  gpio_set_level(GPIO_SPI_SCK, 0);
-  gpio_set_level(GPIO_SPI_DO,  0);
+  ESP_LOGI(TAG, "Player %d waiting, %d in line.", player, waiting_count);
+}
 
-  memset(&io_conf, 0, sizeof(io_conf));
+void GolfGameBase::player_start(int player, int64_t timestamp)
+{
+  for (int i = 0; i < MAX_ACTIVE_PLAYERS; i++)
+  {
+    if (active[i] >= 0) { continue; }
 
-  // Set GPIO_NUM_5 as input.
-  io_conf.intr_type    = GPIO_INTR_DISABLE;
-  io_conf.mode         = GPIO_MODE_INPUT;
-  io_conf.pin_bit_mask = (1ULL << GPIO_SPI_DI);
-  io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
-  io_conf.pull_up_en   = GPIO_PULLUP_DISABLE;
-  gpio_config(&io_conf);
+    active[i] = player;
+    active_count++;
+
+    strokes[player] = 0;
+    start_time[player] = timestamp;
+    stroke_time[player] = timestamp;
+    idle_since[player] = esp_timer_get_time();
+
+    ESP_LOGI(TAG, "Player %d starts, %d on the hole.", player, active_count);
+
+    play_song_begin();
+    return;
+  }
 }
 
-void GolfGameBase::spi_init()
+void GolfGameBase::player_finish(int slot, int score)
 {
-  spi_bus_config_t spi_bus_config = { };
-  spi_bus_config.sclk_io_num     = GPIO_SPI_SCK;
-  spi_bus_config.mosi_io_num     = GPIO_SPI_DO;
-  spi_bus_config.miso_io_num     = GPIO_SPI_DI;
-#if 0
-  spi_bus_config.data0_io_num    = -1;
-  spi_bus_config.data1_io_num    = -1;
-  spi_bus_config.data2_io_num    = -1;
-  spi_bus_config.data3_io_num    = -1;
-  spi_bus_config.data4_io_num    = -1;
-  spi_bus_config.data5_io_num    = -1;
-  spi_bus_config.data6_io_num    = -1;
-  spi_bus_config.data7_io_num    = -1;
-#endif
-  spi_bus_config.quadwp_io_num   = -1;
-  spi_bus_config.quadhd_io_num   = -1;
-  spi_bus_config.max_transfer_sz = 1;
-
-  spi_bus_initialize(SPI2_HOST, &spi_bus_config, SPI_DMA_CH_AUTO);
-
-  spi_device_interface_config_t spi_dev_config = { };
-  spi_dev_config.spics_io_num   = -1;
-  spi_dev_config.command_bits   = 0;
-  spi_dev_config.address_bits   = 0;
-  spi_dev_config.mode           = 0;
-  spi_dev_config.queue_size     = 7;
-  //spi_dev_config.clock_source   = SPI_CLK_SRC_DEFAULT;
-  spi_dev_config.clock_speed_hz = 100000;
-
-  spi_bus_add_device(SPI2_HOST, &spi_dev_config, &spi_handle);
+  int player = active[slot];
+
+  // -1 is a player who gave up, their last score stays.
+  if (score >= 0) { hits[player] = score; }
+
+  active[slot] = -1;
+  active_count--;
+
+  if (waiting_count != 0)
+  {
+    int next = waiting[waiting_first];
+
+    waiting_first = (waiting_first + 1) % MAX_PLAYERS;
+    waiting_count--;
+
+    player_start(next, esp_timer_get_time());
+  }
 }
 
-void GolfGameBase::spi_send(uint8_t ch)
+int GolfGameBase::player_slot(int player)
 {
-  //spi_send_sw(ch);
-  //return;
-
-  spi_transaction_t trans_desc = { };
-  trans_desc.cmd = 0;
-  trans_desc.length = 8;
-  trans_desc.tx_buffer = &ch;
-  //trans_desc.tx_data[0] = ch;
-  //trans_desc.tx_data[1] = ch;
-  //trans_desc.tx_data[2] = ch;
-  //trans_desc.tx_data[3] = ch;
-
-  spi_device_transmit(spi_handle, &trans_desc);
+  for (int i = 0; i < MAX_ACTIVE_PLAYERS; i++)
+  {
+    if (active[i] == player) { return i; }
+  }
+
+  return -1;
 }
 
-void GolfGameBase::spi_send_sw(uint8_t ch)
+void GolfGameBase::hole_add(int64_t timestamp)
 {
-  int i;
-  int data = ch & 0xff;
+  // A ball that dropped before anyone started isn't anyone's.
+  bool is_playing = false;
+  bool is_match = false;
 
-  for (i = 0; i < 8; i++)
+  for (int i = 0; i < MAX_ACTIVE_PLAYERS; i++)
   {
-    if ((data & 0x80) != 0)
-    {
-      gpio_set_level(GPIO_SPI_DO,  1);
-    }
+    int player = active[i];
 
-    data = data << 1;
+    if (player < 0 || start_time[player] > timestamp) { continue; }
 
-    gpio_set_level(GPIO_SPI_SCK, 1);
-    ets_delay_us(10);
-    gpio_set_level(GPIO_SPI_SCK, 0);
+    is_playing = true;
 
-    gpio_set_level(GPIO_SPI_DO, 0);
+    if (is_hole_match(player, timestamp)) { is_match = true; }
   }
-}
 
-void GolfGameBase::display_clear()
-{
-  gpio_set_level(GPIO_SPI_CS, 0);
+  if (! is_playing) { return; }
+
+  // The last ball that went in rattling out and back in after the
+  // lockout. It's already counted. A second ball dropping in knocks the
+  // first one too, so it's only a rattle if no ball still in play could
+  // be the one that dropped.
+  if (! is_match &&
+      last_holed >= 0 &&
+      player_slot(last_holed) < 0 &&
+      is_hole_match(last_holed, timestamp))
+  {
+    ESP_LOGI(TAG, "Drop matches player %d's ball again, ignored.",
+      last_holed);
+    return;
+  }
+
+  // More drops than players, the oldest has waited long enough.
+  if (hole_count == MAX_ACTIVE_PLAYERS)
+  {
+    hole_in(0, hole_guess(hole_times[0]));
+  }
 
-  // 0x7c, 0x2d: Clear.
-  spi_send('|');
-  spi_send(0x2d);
+  hole_times[hole_count++] = timestamp;
 
-  gpio_set_level(GPIO_SPI_CS, 1);
+  // The ball may have gone still (and had its stroke counted) before
+  // the switch settled.
+  for (int i = 0; i < MAX_ACTIVE_PLAYERS; i++)
+  {
+    int player = active[i];
+
+    if (player < 0) { continue; }
+    if (stroke_time[player] < timestamp) { continue; }
+
+    if (start_time[player] <= timestamp && is_hole_match(player, timestamp))
+    {
+      hole_in(hole_count - 1, player);
+      return;
+    }
+  }
 }
 
-void GolfGameBase::display_show(const char *text)
+int GolfGameBase::hole_find(int player)
 {
-  gpio_set_level(GPIO_SPI_CS, 0);
-
-  while (*text != 0)
+  for (int i = 0; i < hole_count; i++)
   {
-    spi_send(*text);
-    text++;
+    if (start_time[player] > hole_times[i]) { continue; }
+
+    if (is_hole_match(player, hole_times[i])) { return i; }
   }
 
-  gpio_set_level(GPIO_SPI_CS, 1);
+  return -1;
 }
 
-void GolfGameBase::display_show(int value)
+void GolfGameBase::hole_in(int hole, int player)
 {
-  gpio_set_level(GPIO_SPI_CS, 0);
+  int64_t timestamp = hole_times[hole];
 
-  char digits[8];
-  int ptr = 0;
+  hole_count--;
 
-  while (value > 0)
+  for (int i = hole; i < hole_count; i++)
   {
+    hole_times[i] = hole_times[i + 1];
+  }
 
-    digits[ptr++] = value % 10;
+  if (player < 0) { return; }
 
-    value = value / 10;
-  }
+  // The putt that went in counts too, unless its stroke already came
+  // in after the drop.
+  int score = strokes[player] + (stroke_time[player] >= timestamp ? 0 : 1);
 
-  if (ptr == 0) { digits[ptr++] = 0; }
+  ESP_LOGI(TAG, "Hole in for player %d in %d.", player, score);
 
-  while (ptr > 0)
-  {
-    spi_send(digits[--ptr] + '0');
-  }
+  last_holed = player;
 
-  gpio_set_level(GPIO_SPI_CS, 1);
+  player_finish(player_slot(player), score);
+  play_song_finish();
 }
 
-void GolfGameBase::display_update(int value)
+void GolfGameBase::hole_expire(int64_t now)
 {
-  display_clear();
-  display_show("Player 1: ");
-  display_show(hits[0]);
-  display_show("\r");
-  display_show("Player 2: ");
-  display_show(hits[1]);
-  display_show("\r");
-  display_show("Player 3: ");
-  display_show(hits[2]);
-  display_show("\r");
-
-  if (value >= 0)
+  while (hole_count != 0 &&
+         now - hole_times[0] > (int64_t)HOLE_WAIT_MS * 1000)
   {
-    display_show("Current Player:");
-    display_show(value);
+    int player = hole_guess(hole_times[0]);
+
+    ESP_LOGW(TAG, "No ball went still after a drop, guessing player %d.",
+      player);
+
+    hole_in(0, player);
   }
+}
+
+bool GolfGameBase::is_hole_match(int player, int64_t timestamp)
+{
+  uint32_t last_moved = NanoBeacon::beacons.last_moved_ms[player].load();
 
-  //display_show('+');
-  //display_show(',');
+  if (last_moved == 0) { return false; }
+
+  int32_t diff = (int32_t)(last_moved - (uint32_t)(timestamp / 1000));
+
+  return diff >= -HOLE_MATCH_MS && diff <= HOLE_SETTLE_MS;
 }
 
-void GolfGameBase::display_set_color(int r, int g, int b)
+int GolfGameBase::hole_guess(int64_t timestamp)
 {
-  if (r > 29) { r = 29; }
-  if (g > 29) { g = 29; }
-  if (b > 29) { b = 29; }
-
-  gpio_set_level(GPIO_SPI_CS, 0);
-
-  spi_send('|');
-  spi_send(0x80 + r);
-  spi_send('|');
-  spi_send(0x9e + g);
-  spi_send('|');
-  spi_send(0xbc + b);
-
-#if 0
-  spi_send('|');
-  spi_send('+');
-  spi_send(r);
-  spi_send(g);
-  spi_send(b);
-  spi_send(0);
-#endif
-
-  gpio_set_level(GPIO_SPI_CS, 1);
+  // The ball whose last movement is closest to the drop. If no beacon
+  // has moved since its player started, it's the player who has been on
+  // the hole longest.
+  int closest = -1;
+  int32_t closest_ms = 0;
+  int oldest = -1;
+
+  for (int i = 0; i < MAX_ACTIVE_PLAYERS; i++)
+  {
+    int player = active[i];
+
+    if (player < 0) { continue; }
+    if (start_time[player] > timestamp) { continue; }
+
+    uint32_t start_ms = start_time[player] / 1000;
+    uint32_t last_moved = NanoBeacon::beacons.last_moved_ms[player].load();
+
+    if (last_moved != 0 && (int32_t)(last_moved - start_ms) >= 0)
+    {
+      int32_t diff = (int32_t)(last_moved - (uint32_t)(timestamp / 1000));
+
+      if (diff < 0) { diff = -diff; }
+
+      if (closest == -1 || diff < closest_ms)
+      {
+        closest = player;
+        closest_ms = diff;
+      }
+    }
+
+    if (oldest == -1 || start_time[player] < start_time[oldest])
+    {
+      oldest = player;
+    }
+  }
+
+  return closest != -1 ? closest : oldest;
 }
 
-void GolfGameBase::set_tone(int frequency)
+int GolfGameBase::current_player()
 {
-  if (frequency == 0)
+  // The one who started last is the one at the tee.
+  int current = -1;
+
+  for (int i = 0; i < MAX_ACTIVE_PLAYERS; i++)
   {
-    // Turn off sound.
-    gpio_set_level(GPIO_SPEAKER, 0);
-    ledc_stop(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, 0);
-    return;
+    int player = active[i];
+
+    if (player < 0) { continue; }
+
+    if (current == -1 || start_time[player] > start_time[current])
+    {
+      current = player;
+    }
   }
 
-  ledc_timer_config_t ledc_timer = { };
-  ledc_timer.speed_mode      = LEDC_LOW_SPEED_MODE;
-  ledc_timer.timer_num       = LEDC_TIMER_0;
-  ledc_timer.duty_resolution = LEDC_TIMER_8_BIT;
-  ledc_timer.freq_hz         = frequency;
-  ledc_timer.clk_cfg         = LEDC_AUTO_CLK;
+  return current;
+}
+
+void GolfGameBase::gpio_init()
+{
+  // Zero-initialize the config structure.
+  gpio_config_t io_conf = { };
+
+  // The hole switch pulls GPIO_HOLE low, every edge interrupts so even
+  // a short closure is caught and debounced.
+  hole.start(GPIO_HOLE, events, HOLE_GLITCH_US, HOLE_LOCKOUT_MS);
+
+  // Setup SPI chip select.
+  memset(&io_conf, 0, sizeof(io_conf));
+  io_conf.intr_type    = GPIO_INTR_DISABLE;
+  io_conf.mode         = GPIO_MODE_OUTPUT;
+  io_conf.pin_bit_mask =
+    (1ULL << GPIO_SPEAKER) |
+    (1ULL << GPIO_SPI_CS)  |
+    (1ULL << GPIO_SPI_SCK) |
+    (1ULL << GPIO_SPI_DO);
+  io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+  io_conf.pull_up_en   = GPIO_PULLUP_DISABLE;
+
+  gpio_config(&io_conf);
+
+  // GPIO_NUM_0: Speaker.
+  // GPIO_NUM_4: /CS
+  // GPIO_NUM_5: DI
+  // GPIO_NUM_6: SCK
+  // GPIO_NUM_7: DO
+  gpio_set_level(GPIO_SPEAKER, 0);
+  gpio_set_level(GPIO_SPI_CS,  1);
+  gpio_set_level(GPIO_SPI_DI,  0);
+  gpio_set_level(GPIO_SPI_SCK, 0);
+  gpio_set_level(GPIO_SPI_DO,  0);
+
+  memset(&io_conf, 0, sizeof(io_conf));
+
+  // Set GPIO_NUM_5 as input.
+  io_conf.intr_type    = GPIO_INTR_DISABLE;
+  io_conf.mode         = GPIO_MODE_INPUT;
+  io_conf.pin_bit_mask = (1ULL << GPIO_SPI_DI);
+  io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+  io_conf.pull_up_en   = GPIO_PULLUP_DISABLE;
+  gpio_config(&io_conf);
+}
 
-  ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
+void GolfGameBase::display_update(int value)
+{
+  // Only records what the screen should show, the display task sends
+  // the cells that changed on its own time.
+  char screen[Display::ROWS][Display::COLUMNS];
 
-  ledc_channel_config_t ledc_channel = { };
-  ledc_channel.speed_mode = LEDC_LOW_SPEED_MODE;
-  ledc_channel.channel    = LEDC_CHANNEL_0;
-  ledc_channel.timer_sel  = LEDC_TIMER_0;
-  ledc_channel.intr_type  = LEDC_INTR_DISABLE;
-  ledc_channel.gpio_num   = GPIO_SPEAKER;
-  ledc_channel.duty       = frequency / 2;
-  ledc_channel.hpoint     = 0;
+  SCOREBOARD.render(screen, hits, value);
 
-  ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel));
+  display.set_screen(screen);
+  display.flush();
+}
 
-  gpio_set_level(GPIO_SPEAKER, 1);
+void GolfGameBase::display_set_color(const Display::Color &color)
+{
+  display.set_color(color);
 }
 
 void GolfGameBase::play_song_begin()
 {
-  // A4 G5.
-  set_tone(440);
-  vTaskDelay(100 / portTICK_PERIOD_MS);
-  set_tone(784);
-  vTaskDelay(100 / portTICK_PERIOD_MS);
-  set_tone(0);
+  speaker.play(SONG_BEGIN);
 }
 
 void GolfGameBase::play_song_hit()
 {
-  // G5 A4.
-  set_tone(784);
-  vTaskDelay(100 / portTICK_PERIOD_MS);
-  set_tone(440);
-  vTaskDelay(100 / portTICK_PERIOD_MS);
-  set_tone(0);
+  speaker.play(SONG_HIT);
 }
 
 void GolfGameBase::play_song_finish()
 {
-  // G4 B4 D5 B4 G5
-  set_tone(392);
-  vTaskDelay(100 / portTICK_PERIOD_MS);
-  set_tone(494);
-  vTaskDelay(100 / portTICK_PERIOD_MS);
-  set_tone(587);
-  vTaskDelay(100 / portTICK_PERIOD_MS);
-  set_tone(494);
-  vTaskDelay(100 / portTICK_PERIOD_MS);
-  set_tone(784);
-  vTaskDelay(100 / portTICK_PERIOD_MS);
-  set_tone(0);
+  speaker.play(SONG_FINISH);
+}
+
+void GolfGameBase::on_status_timer(void *context)
+{
+  GolfGameBase *golf_game_base = (GolfGameBase *)context;
+
+  golf_game_base->events.notify();
 }
 
+// A4 G5.
+const Speaker::Note GolfGameBase::SONG_BEGIN[] =
+{
+  { 440, 100 },
+  { 784, 100 },
+  {   0,   0 },
+};
+
+// G5 A4.
+const Speaker::Note GolfGameBase::SONG_HIT[] =
+{
+  { 784, 100 },
+  { 440, 100 },
+  {   0,   0 },
+};
+
+// G4 B4 D5 B4 G5
+const Speaker::Note GolfGameBase::SONG_FINISH[] =
+{
+  { 392, 100 },
+  { 494, 100 },
+  { 587, 100 },
+  { 494, 100 },
+  { 784, 100 },
+  {   0,   0 },
+};
+
 const char *GolfGameBase::TAG = "BASE";
 
@@ -16,8 +16,13 @@
 
 #include <string.h>
 
-#include "driver/spi_master.h"
-#include "driver/spi_common.h"
+#include "esp_timer.h"
+
+#include "Display.h"
+#include "EventQueue.h"
+#include "HoleSwitch.h"
+#include "Scoreboard.h"
+#include "Speaker.h"
 
 class GolfGameBase
 {
@@ -29,24 +34,94 @@ public:
 
 private:
   void gpio_init();
-  void spi_init();
-  void spi_send(uint8_t ch);
-  void spi_send_sw(uint8_t ch);
-  void display_clear();
-  void display_show(const char *text);
-  void display_show(int value);
   void display_update(int value = -1);
-  void display_set_color(int r, int g, int b);
-  void set_tone(int frequency);
+  void display_set_color(const Display::Color &color);
   void play_song_begin();
   void play_song_hit();
   void play_song_finish();
 
+  void player_check_in(int player, int64_t timestamp);
+  void player_start(int player, int64_t timestamp);
+  void player_finish(int slot, int score);
+  int player_slot(int player);
+  void hole_add(int64_t timestamp);
+  int hole_find(int player);
+  void hole_in(int hole, int player);
+  void hole_expire(int64_t now);
+  bool is_hole_match(int player, int64_t timestamp);
+  int hole_guess(int64_t timestamp);
+  int current_player();
+
+  static void on_status_timer(void *context);
+
   //void run_game(int player);
 
-  spi_device_handle_t spi_handle;
+  Display display;
+
+  int16_t hits[MAX_PLAYERS];
+
+  // Players on the hole by index (player - 1), -1 is a free slot. Each
+  // one's strokes come from their own beacon so they can play at the
+  // same time. Taps while every slot is taken wait in waiting[], oldest
+  // first.
+  int8_t active[MAX_ACTIVE_PLAYERS];
+  int active_count;
+  int8_t waiting[MAX_PLAYERS];
+  int waiting_first;
+  int waiting_count;
+
+  int16_t strokes[MAX_PLAYERS];
+  int64_t start_time[MAX_PLAYERS];
+  int64_t stroke_time[MAX_PLAYERS];
+
+  // When the base last heard from each player, for the idle timeout. A
+  // tap can sit in the tee's queue while it's disconnected, so this is
+  // the base's clock when the tap or stroke arrived, not its timestamp.
+  int64_t idle_since[MAX_PLAYERS];
+
+  // Drops not yet given to a player, oldest first. The switch can't tell
+  // whose ball it was, so that waits until a ball that last moved when
+  // it dropped goes still.
+  int64_t hole_times[MAX_ACTIVE_PLAYERS];
+  int hole_count;
+  int last_holed;
+
+  // Inputs from the tees, the beacons and the hole.
+  EventQueue events;
+  HoleSwitch hole;
+  Speaker speaker;
+  uint32_t dropped[EventQueue::EVENT_TYPES];
+  uint32_t hole_glitches;
+  uint32_t hole_ignored;
+  esp_timer_handle_t status_timer;
+
+  // How often connection state and beacon liveness are checked when
+  // nothing else wakes the game loop.
+  static const int STATUS_INTERVAL_MS = 500;
+
+  // A beacon not heard from in this long shows as down on the status
+  // page.
+  static const int BEACON_TIMEOUT_MS = 5000;
+
+  // A ball that went still and last moved from HOLE_MATCH_MS before a
+  // drop to HOLE_SETTLE_MS after it (rattling in the cup) can be the one
+  // that went in. A ball still rolling keeps moving past that. A drop no
+  // ball could be matched to in HOLE_WAIT_MS goes to the best guess.
+  static const int HOLE_MATCH_MS = 1000;
+  static const int HOLE_SETTLE_MS = 250;
+  static const int HOLE_WAIT_MS = 3000;
+
+  static constexpr Scoreboard SCOREBOARD { };
+
+  // Backlight: red with no network, green while a player is up and blue
+  // between players.
+  static constexpr Display::Color COLOR_DISCONNECTED = Display::rgb(29, 0, 0);
+  static constexpr Display::Color COLOR_PLAYING      = Display::rgb(0, 29, 0);
+  static constexpr Display::Color COLOR_IDLE         = Display::rgb(0, 0, 29);
 
-  int hits[3];
+  static const Speaker::Note SONG_BEGIN[];
+  static const Speaker::Note SONG_HIT[];
+  static const Speaker::Note SONG_FINISH[];
 
   static const char *TAG;
 };
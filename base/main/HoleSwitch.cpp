@@ -0,0 +1,154 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "HoleSwitch.h"
+
+HoleSwitch::HoleSwitch() :
+  spinlock    portMUX_INITIALIZER_UNLOCKED,
+  gpio        { GPIO_NUM_0 },
+  events      { NULL },
+  timer       { NULL },
+  glitch_us   { 0 },
+  lockout_us  { 0 },
+  is_pending  { false },
+  first_edge  { 0 },
+  lockout_end { 0 },
+  closed      { false },
+  glitches    { 0 },
+  ignored     { 0 }
+{
+}
+
+HoleSwitch::~HoleSwitch()
+{
+  if (timer == NULL) { return; }
+
+  gpio_isr_handler_remove(gpio);
+  esp_timer_stop(timer);
+  esp_timer_delete(timer);
+}
+
+int HoleSwitch::start(
+  gpio_num_t gpio,
+  EventQueue &events,
+  int glitch_us,
+  int lockout_ms)
+{
+  this->gpio       = gpio;
+  this->events     = &events;
+  this->glitch_us  = glitch_us;
+  this->lockout_us = (int64_t)lockout_ms * 1000;
+
+  esp_timer_create_args_t timer_args = { };
+  timer_args.callback = on_settled;
+  timer_args.arg      = this;
+  timer_args.name     = "hole";
+
+  if (esp_timer_create(&timer_args, &timer) != ESP_OK)
+  {
+    ESP_LOGE("hole", "Can't create timer.");
+    return -1;
+  }
+
+  // Both edges so the timer knows when the input stopped bouncing.
+  gpio_config_t io_conf = { };
+  io_conf.intr_type    = GPIO_INTR_ANYEDGE;
+  io_conf.mode         = GPIO_MODE_INPUT;
+  io_conf.pin_bit_mask = (1ULL << gpio);
+  io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+  io_conf.pull_up_en   = GPIO_PULLUP_ENABLE;
+  gpio_config(&io_conf);
+
+  closed = gpio_get_level(gpio) == 0;
+
+  gpio_install_isr_service(0);
+  gpio_isr_handler_add(gpio, on_edge, this);
+
+  return 0;
+}
+
+void HoleSwitch::on_edge(void *context)
+{
+  HoleSwitch *hole = (HoleSwitch *)context;
+
+  int64_t now = esp_timer_get_time();
+
+  portENTER_CRITICAL_ISR(&hole->spinlock);
+
+  if (! hole->is_pending)
+  {
+    hole->is_pending = true;
+    hole->first_edge = now;
+  }
+
+  // Restarting on every edge means the timer fires glitch_us after the
+  // last one.
+  esp_timer_stop(hole->timer);
+  esp_timer_start_once(hole->timer, hole->glitch_us);
+
+  portEXIT_CRITICAL_ISR(&hole->spinlock);
+}
+
+void HoleSwitch::on_settled(void *context)
+{
+  HoleSwitch *hole = (HoleSwitch *)context;
+
+  bool is_hole_in = false;
+  int64_t drop_time = 0;
+
+  portENTER_CRITICAL(&hole->spinlock);
+
+  bool is_closed = gpio_get_level(hole->gpio) == 0;
+
+  if (hole->is_pending)
+  {
+    hole->is_pending = false;
+
+    if (is_closed && ! hole->closed)
+    {
+      drop_time = hole->first_edge;
+
+      // The edges are still followed in the lockout so the switch
+      // opening again isn't missed, only the hole-in is dropped.
+      if (drop_time < hole->lockout_end)
+      {
+        hole->ignored++;
+      }
+        else
+      {
+        is_hole_in = true;
+        hole->lockout_end = drop_time + hole->lockout_us;
+      }
+    }
+      else
+    if (is_closed == hole->closed)
+    {
+      // Bounced but ended up where it started.
+      hole->glitches++;
+    }
+
+    hole->closed = is_closed;
+  }
+
+  portEXIT_CRITICAL(&hole->spinlock);
+
+  if (is_hole_in)
+  {
+    hole->events->push(EventQueue::EVENT_HOLE, 0, 0, drop_time);
+  }
+}
+
@@ -0,0 +1,69 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#ifndef HOLE_SWITCH_H
+#define HOLE_SWITCH_H
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
+#include "esp_timer.h"
+
+#include "EventQueue.h"
+
+// The switch in the hole, closed (pulled low) while a ball sits on it.
+// The ISR timestamps every edge and restarts a one shot timer, so the
+// timer only fires once the input has been stable for glitch_us. If it
+// settled closed, one EVENT_HOLE is pushed with the time of the first
+// edge of the burst (when the ball dropped). Another closure within
+// lockout_ms of that is not reported, so a ball that bounces out and
+// back in counts once.
+class HoleSwitch
+{
+public:
+  HoleSwitch();
+  ~HoleSwitch();
+
+  int start(
+    gpio_num_t gpio,
+    EventQueue &events,
+    int glitch_us,
+    int lockout_ms);
+
+  // Closures that didn't last glitch_us, and closures in the lockout.
+  uint32_t get_glitches() { return glitches; }
+  uint32_t get_ignored() { return ignored; }
+
+private:
+  static void on_edge(void *context);
+  static void on_settled(void *context);
+
+  portMUX_TYPE spinlock;
+  gpio_num_t gpio;
+  EventQueue *events;
+  esp_timer_handle_t timer;
+  int glitch_us;
+  int64_t lockout_us;
+
+  // Shared between the ISR and the timer task under spinlock.
+  bool is_pending;
+  int64_t first_edge;
+  int64_t lockout_end;
+  volatile bool closed;
+  uint32_t glitches;
+  uint32_t ignored;
+};
+
+#endif
+
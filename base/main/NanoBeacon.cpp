@@ -23,11 +23,15 @@
 #include "esp_gattc_api.h"
 #include "esp_gatt_defs.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "NanoBeacon.h"
 
-NanoBeacon::NanoBeacon()
+NanoBeacon::NanoBeacon(EventQueue &events)
 {
+  // Set before scanning starts since the callback is what uses it.
+  NanoBeacon::events = &events;
+
   ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
 
   esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
@@ -106,7 +110,8 @@ bool NanoBeacon::is_ibeacon_packet(uint8_t *adv_data, uint8_t adv_data_len)
   return result;
 }
 
-NanoBeacon::Rotation NanoBeacon::rotations[3];
+NanoBeacon::Beacons NanoBeacon::beacons;
+EventQueue *NanoBeacon::events = NULL;
 
 void NanoBeacon::callback(
   esp_gap_ble_cb_event_t event,
@@ -202,8 +207,7 @@ void NanoBeacon::callback(
             char hex[4];
 
             // Look for a NanoBeacon with this made up address. The last
-            // byte is the unique ID for the 3 beacons being used for this
-            // project.
+            // byte is the player the beacon belongs to, 1 to MAX_PLAYERS.
             const uint8_t address[] = { 0x06, 0x05, 0x04, 0x03, 0x02, 0x01 };
             bool use_data = false;
             int index = 0;
@@ -214,12 +218,14 @@ void NanoBeacon::callback(
               {
                 use_data = true;
                 index = scan_result->scan_rst.bda[5] - 1;
-                if (index < 0 || index > 2) { index = 0; }
+                if (index < 0 || index >= MAX_PLAYERS) { use_data = false; }
               }
             }
 
             if (! use_data) { break; }
 
+            beacons.last_seen_ms[index] = esp_timer_get_time() / 1000;
+
             esp_log_buffer_hex("Address:",
               scan_result->scan_rst.bda, ESP_BD_ADDR_LEN );
 
@@ -238,56 +244,55 @@ void NanoBeacon::callback(
 
             if (adv_data[0] == 0xff && adv_data[1] == 0xff)
             {
-              int v0 = adv_data[2] | (adv_data[3] << 8);
-              int v1 = adv_data[4] | (adv_data[5] << 8);
-              int v2 = adv_data[6] | (adv_data[7] << 8);
+              int16_t v[3];
+              v[0] = adv_data[2] | (adv_data[3] << 8);
+              v[1] = adv_data[4] | (adv_data[5] << 8);
+              v[2] = adv_data[6] | (adv_data[7] << 8);
 
-              Rotation &rotation = rotations[index];
-
-              if (rotation.values[0] == 0)
+              if (! Beacons::get_flag(beacons.has_reading, index))
               {
-                rotation.values[0] = v0;
-                rotation.values[1] = v1;
-                rotation.values[2] = v2;
+                for (int i = 0; i < 3; i++) { beacons.axes[i][index] = v[i]; }
+                Beacons::set_flag(beacons.has_reading, index, true);
               }
 
-              int d0 = rotation.values[0] - v0;
-              int d1 = rotation.values[1] - v1;
-              int d2 = rotation.values[2] - v2;
+              int changes = 0;
 
-              if (d0 < 0) { d0 = -d0; }
-              if (d1 < 0) { d1 = -d1; }
-              if (d2 < 0) { d2 = -d2; }
+              for (int i = 0; i < 3; i++)
+              {
+                // Differences are taken in 16 bits so a reading that
+                // wraps around is still a small change.
+                int16_t d = beacons.axes[i][index] - v[i];
 
-              int changes = 0;
+                if (d < -2 || d > 2) { changes += 1; }
+              }
 
-              if (d0 > 2) { changes += 1; }
-              if (d1 > 2) { changes += 1; }
-              if (d2 > 2) { changes += 1; }
+              uint8_t &still_count = beacons.still_count[index];
 
               if (changes >= 1)
               {
-                rotation.values[0] = v0;
-                rotation.values[1] = v1;
-                rotation.values[2] = v2;
-
-                rotation.movement += 1;
-                rotation.no_movement = 0;
-
-                ESP_LOGI(TAG, "MOVED %d %d / %d %d",
-                  rotation.movement,
-                  rotation.no_movement,
-                  rotation.flags,
-                  rotation.clear_flags);
+                for (int i = 0; i < 3; i++) { beacons.axes[i][index] = v[i]; }
+
+                Beacons::set_flag(beacons.is_moving, index, true);
+                still_count = 0;
+
+                beacons.last_moved_ms[index] = esp_timer_get_time() / 1000;
+
+                ESP_LOGI(TAG, "MOVED %d", index + 1);
               }
                 else
               {
-                rotation.no_movement += 1;
+                if (still_count < 255) { still_count += 1; }
 
-                if (rotation.movement != 0 && rotation.no_movement > 1)
+                if (Beacons::get_flag(beacons.is_moving, index) &&
+                    still_count > 1)
                 {
-                  rotation.movement = 0;
-                  rotation.flags = 1;
+                  Beacons::set_flag(beacons.is_moving, index, false);
+
+                  events->push(
+                    EventQueue::EVENT_STROKE,
+                    index,
+                    0,
+                    esp_timer_get_time());
                 }
               }
             }
@@ -301,15 +306,6 @@ void NanoBeacon::callback(
         }
       }
 
-      for (int i = 0; i < 3; i++)
-      {
-        if (rotations[i].clear_flags)
-        {
-          rotations[i].clear_flags = false;
-          rotations[i].flags       = 0;
-        }
-      }
-
       break;
     }
     case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
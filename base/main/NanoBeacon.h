@@ -14,37 +14,85 @@
 #ifndef NANO_BEACON_H
 #define NANO_BEACON_H
 
+#include <stdint.h>
 #include <string.h>
+#include <atomic>
 
 #include "esp_gap_ble_api.h"
 
+#include "defines.h"
+#include "EventQueue.h"
+
 class NanoBeacon
 {
 public:
-  NanoBeacon();
+  NanoBeacon(EventQueue &events);
   ~NanoBeacon();
 
-  struct Rotation
+  // The state of every beacon, indexed by player - 1. Each field is its
+  // own array so a pass over all the beacons only touches the field it
+  // needs, the readings are kept as 16 bits like they're sent and the
+  // yes / no state is one bit per beacon.
+  struct Beacons
   {
-    Rotation() :
-      movement    { 0 },
-      no_movement { 0 },
-      flags       { 0 },
-      clear_flags { false }
+    Beacons() { clear(); }
+
+    static const int FLAG_WORDS = (MAX_PLAYERS + 31) / 32;
+
+    void clear()
+    {
+      memset(axes, 0, sizeof(axes));
+      memset(still_count, 0, sizeof(still_count));
+      memset(has_reading, 0, sizeof(has_reading));
+      memset(is_moving, 0, sizeof(is_moving));
+
+      for (int i = 0; i < MAX_PLAYERS; i++)
+      {
+        last_seen_ms[i] = 0;
+        last_moved_ms[i] = 0;
+      }
+    }
+
+    static bool get_flag(const uint32_t *flags, int index)
     {
-      memset(values, 0, sizeof(values));
+      return (flags[index >> 5] & (1u << (index & 31))) != 0;
     }
 
-    int movement;
-    int no_movement;
-    int flags;
-    int values[3];
-    bool clear_flags;
+    static void set_flag(uint32_t *flags, int index, bool value)
+    {
+      if (value)
+      {
+        flags[index >> 5] |= 1u << (index & 31);
+      }
+        else
+      {
+        flags[index >> 5] &= ~(1u << (index & 31));
+      }
+    }
+
+    // Only used from the Bluetooth task, a stroke is sent to the game
+    // loop as an EventQueue::EVENT_STROKE.
+    int16_t axes[3][MAX_PLAYERS];
+    uint8_t still_count[MAX_PLAYERS];
+    uint32_t has_reading[FLAG_WORDS];
+    uint32_t is_moving[FLAG_WORDS];
+
+    // Read by the game loop to show if the beacon is alive. Milliseconds
+    // since boot so it's a plain 32 bit store, 0 is never seen.
+    std::atomic<uint32_t> last_seen_ms[MAX_PLAYERS];
+
+    // When the ball last moved, so the game loop can tell whose ball
+    // went in the hole.
+    std::atomic<uint32_t> last_moved_ms[MAX_PLAYERS];
   };
 
-  static Rotation rotations[3];
+  static Beacons beacons;
+  static EventQueue *events;
 
 private:
+  // The beacon index goes to the game loop as an int8_t event source.
+  static_assert(MAX_PLAYERS >= 1 && MAX_PLAYERS <= 127);
+
   void init();
 
   void register_callback();
@@ -0,0 +1,335 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "NetconnTransport.h"
+
+NetconnTransport::NetconnTransport() :
+  conn         { NULL },
+  netbuf       { NULL },
+  offset       { 0 },
+  event_id     { -1 },
+  peer_address { 0 }
+{
+}
+
+NetconnTransport::~NetconnTransport()
+{
+  close();
+
+  if (event_id != -1) { ::close(event_id); }
+}
+
+int NetconnTransport::listen(int port)
+{
+  if (open_event() != 0) { return -1; }
+
+  conn = netconn_new_with_callback(NETCONN_TCP, on_event);
+
+  if (conn == NULL)
+  {
+    ESP_LOGE("netconn", "Can't create netconn.");
+    return -1;
+  }
+
+  netconn_set_callback_arg(conn, this);
+  netconn_set_nonblocking(conn, 1);
+
+  if (netconn_bind(conn, IP_ADDR_ANY, port) != ERR_OK ||
+      netconn_listen(conn) != ERR_OK)
+  {
+    ESP_LOGE("netconn", "Can't listen on port %d.", port);
+    close();
+    return -1;
+  }
+
+  return 0;
+}
+
+int NetconnTransport::accept(NetconnTransport &client)
+{
+  struct netconn *new_conn;
+
+  err_t err = netconn_accept(conn, &new_conn);
+
+  if (err == ERR_WOULDBLOCK)
+  {
+    // Clear before trying again so a connection that comes in between
+    // signals the eventfd again.
+    clear_signal();
+    err = netconn_accept(conn, &new_conn);
+  }
+
+  if (err != ERR_OK) { return -1; }
+
+  if (client.open_event() != 0)
+  {
+    ESP_LOGE("netconn", "No eventfd for a new connection.");
+    netconn_close(new_conn);
+    netconn_delete(new_conn);
+    return -1;
+  }
+
+  client.attach(new_conn);
+
+  return 0;
+}
+
+Network::Status NetconnTransport::send(
+  const uint8_t *buffer,
+  int length,
+  int64_t deadline,
+  int *count,
+  Network::Cancel *cancel)
+{
+  *count = 0;
+
+  while (*count < length)
+  {
+    size_t written = 0;
+
+    err_t err = netconn_write_partly(
+      conn,
+      buffer + *count,
+      length - *count,
+      NETCONN_COPY | NETCONN_DONTBLOCK,
+      &written);
+
+    *count += written;
+
+    if (err == ERR_OK) { continue; }
+
+    if (err != ERR_WOULDBLOCK)
+    {
+      if (err == ERR_CLSD || err == ERR_RST || err == ERR_ABRT ||
+          err == ERR_CONN)
+      {
+        return Network::NET_CLOSED;
+      }
+
+      return Network::NET_ERROR;
+    }
+
+    // Only happens when the tee stops reading, so polling is fine.
+    if (esp_timer_get_time() >= deadline) { return Network::NET_TIMEOUT; }
+
+    usleep(1000);
+  }
+
+  return Network::NET_OK;
+}
+
+Network::Status NetconnTransport::poll(uint8_t *buffer, int length, int *count)
+{
+  // Copying version for callers that don't use poll_view().
+  *count = 0;
+
+  while (*count < length)
+  {
+    const uint8_t *data;
+    int n;
+
+    Network::Status status = poll_view(&data, &n);
+
+    if (status != Network::NET_OK)
+    {
+      return *count != 0 ? Network::NET_OK : status;
+    }
+
+    if (n > length - *count) { n = length - *count; }
+
+    memcpy(buffer + *count, data, n);
+    consume(n);
+
+    *count += n;
+  }
+
+  return Network::NET_OK;
+}
+
+Network::Status NetconnTransport::poll_view(const uint8_t **data, int *count)
+{
+  Network::Status status = receive();
+
+  if (status != Network::NET_OK) { return status; }
+
+  void *payload;
+  u16_t length;
+
+  netbuf_data(netbuf, &payload, &length);
+
+  *data = (const uint8_t *)payload + offset;
+  *count = length - offset;
+
+  return Network::NET_OK;
+}
+
+void NetconnTransport::consume(int count)
+{
+  if (netbuf == NULL) { return; }
+
+  void *payload;
+  u16_t length;
+
+  netbuf_data(netbuf, &payload, &length);
+
+  offset += count;
+
+  if (offset < length) { return; }
+
+  // Done with this pbuf, move to the next one in the chain.
+  offset = 0;
+
+  if (netbuf_next(netbuf) < 0)
+  {
+    netbuf_delete(netbuf);
+    netbuf = NULL;
+  }
+}
+
+void NetconnTransport::close()
+{
+  if (conn == NULL) { return; }
+
+  if (netbuf != NULL)
+  {
+    netbuf_delete(netbuf);
+    netbuf = NULL;
+  }
+
+  netconn_set_callback_arg(conn, NULL);
+  netconn_close(conn);
+  netconn_delete(conn);
+
+  conn = NULL;
+  offset = 0;
+
+  clear_signal();
+}
+
+void NetconnTransport::on_event(
+  struct netconn *conn,
+  enum netconn_evt event,
+  u16_t length)
+{
+  // Runs in the tcpip thread. A connection that was just accepted can
+  // get data before attach() sets the callback arg, it's still -1 from
+  // lwIP then (the socket layer has the same case). attach() signals
+  // once so that data isn't missed.
+  void *arg = netconn_get_callback_arg(conn);
+
+  if (arg == NULL || arg == (void *)(intptr_t)-1) { return; }
+
+  // RCVPLUS with a length of 0 means the tee closed the connection.
+  if (event == NETCONN_EVT_RCVPLUS || event == NETCONN_EVT_ERROR)
+  {
+    ((NetconnTransport *)arg)->signal();
+  }
+}
+
+int NetconnTransport::open_event()
+{
+  if (event_id != -1) { return 0; }
+
+  event_id = Network::open_eventfd();
+
+  return event_id < 0 ? -1 : 0;
+}
+
+void NetconnTransport::attach(struct netconn *conn)
+{
+  close();
+
+  this->conn = conn;
+
+  netconn_set_callback_arg(conn, this);
+  netconn_set_nonblocking(conn, 1);
+
+  ip_addr_t address;
+  u16_t port;
+
+  peer_address = 0;
+
+  if (netconn_peer(conn, &address, &port) == ERR_OK)
+  {
+    peer_address = ip4_addr_get_u32(ip_2_ip4(&address));
+  }
+
+  signal();
+}
+
+Network::Status NetconnTransport::receive()
+{
+  if (netbuf != NULL) { return Network::NET_OK; }
+  if (conn == NULL) { return Network::NET_CLOSED; }
+
+  err_t err = netconn_recv(conn, &netbuf);
+
+  if (err == ERR_WOULDBLOCK)
+  {
+    // Clear before trying again so data that comes in between signals
+    // the eventfd again.
+    clear_signal();
+    err = netconn_recv(conn, &netbuf);
+  }
+
+  if (err == ERR_OK)
+  {
+    offset = 0;
+    return Network::NET_OK;
+  }
+
+  netbuf = NULL;
+
+  if (err == ERR_WOULDBLOCK) { return Network::NET_TIMEOUT; }
+
+  if (err == ERR_CLSD || err == ERR_RST || err == ERR_ABRT ||
+      err == ERR_CONN)
+  {
+    return Network::NET_CLOSED;
+  }
+
+  return Network::NET_ERROR;
+}
+
+void NetconnTransport::signal()
+{
+  uint64_t value = 1;
+
+  write(event_id, &value, sizeof(value));
+}
+
+void NetconnTransport::clear_signal()
+{
+  if (event_id == -1) { return; }
+
+  // Only read when set, so this never blocks.
+  struct timeval tv = { };
+  fd_set readset;
+
+  FD_ZERO(&readset);
+  FD_SET(event_id, &readset);
+
+  if (select(event_id + 1, &readset, NULL, NULL, &tv) == 1)
+  {
+    uint64_t value;
+    read(event_id, &value, sizeof(value));
+  }
+}
+
@@ -0,0 +1,80 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#ifndef NETCONN_TRANSPORT_H
+#define NETCONN_TRANSPORT_H
+
+#include <stdint.h>
+
+#include "lwip/api.h"
+
+#include "Network.h"
+#include "Transport.h"
+
+// Transport on the lwIP netconn API for the base's side of the control
+// connection. The socket layer copies every payload out of the pbufs and
+// goes through a mailbox to the tcpip thread on each call. Here
+// poll_view() hands out the received pbuf itself, so frames can be
+// decoded in place. lwIP's event callback (which runs in the tcpip
+// thread) writes an eventfd so the Reactor can still wait on get_id().
+// Only accepted connections are supported, open() always fails.
+class NetconnTransport : public Transport
+{
+public:
+  NetconnTransport();
+  ~NetconnTransport() override;
+
+  int listen(int port);
+  int accept(NetconnTransport &client);
+
+  int open() override { return -1; }
+
+  Network::Status send(
+    const uint8_t *buffer,
+    int length,
+    int64_t deadline,
+    int *count,
+    Network::Cancel *cancel = NULL) override;
+
+  Network::Status poll(uint8_t *buffer, int length, int *count) override;
+
+  bool has_view() override { return true; }
+  Network::Status poll_view(const uint8_t **data, int *count) override;
+  void consume(int count) override;
+
+  void close() override;
+
+  int get_id() override { return conn != NULL ? event_id : -1; }
+  uint32_t get_address() override { return peer_address; }
+
+private:
+  static void on_event(
+    struct netconn *conn,
+    enum netconn_evt event,
+    u16_t length);
+
+  int open_event();
+  void attach(struct netconn *conn);
+  Network::Status receive();
+  void signal();
+  void clear_signal();
+
+  struct netconn *conn;
+  struct netbuf *netbuf;
+  int offset;
+  int event_id;
+  uint32_t peer_address;
+};
+
+#endif
+
@@ -25,20 +25,52 @@
 #include "esp_event.h"
 #include "esp_log.h"
 
+#include "esp_timer.h"
+#include "esp_cpu.h"
+
 #include "NetworkServer.h"
+#include "Protocol.h"
 
-NetworkServer::NetworkServer() :
+NetworkServer::NetworkServer(EventQueue &events) :
   control_pid       {  0 },
-  control_socket_id { -1 },
-  player            {  0 }
+  reactor           {  REACTOR_HANDLERS, REACTOR_TIMERS },
+  scheduler         {  reactor },
+  connection_count  {  0 },
+  event_count       {  0 },
+  duplicates        {  0 },
+  log_limit         {  LOG_LIMIT },
+  udp_sequence      {  0 },
+  events            {  events },
+  current_player    {  0 },
+  current_hits      {  0 },
+  hole_glitches     {  0 },
+  hole_ignored      {  0 },
+  status_changed    {  true },
+  status_start      {  0 },
+  status_length     {  0 },
+  server_clients    {  0 },
+  server_sending    {  0 }
 {
+  pthread_mutex_init(&lock, NULL);
+
+  memset(scores, 0, sizeof(scores));
+  memset(beacon_alive, 0, sizeof(beacon_alive));
 }
 
 NetworkServer::~NetworkServer()
 {
+  pthread_mutex_destroy(&lock);
 }
 
 int NetworkServer::start()
+{
+  start_wifi();
+  start_network_thread();
+
+  return 0;
+}
+
+int NetworkServer::start_wifi()
 {
   ESP_ERROR_CHECK(esp_netif_init());
   ESP_ERROR_CHECK(esp_event_loop_create_default());
@@ -60,7 +92,7 @@ int NetworkServer::start()
   wifi_config.ap.ssid_len = sizeof(SSID) - 1;
   wifi_config.ap.channel = CHANNEL;
   strcpy((char *)wifi_config.ap.password, PASSWORD);
-  wifi_config.ap.max_connection = 8;
+  wifi_config.ap.max_connection = MAX_CONNECTIONS;
 #ifdef CONFIG_ESP_WIFI_SOFTAP_SAE_SUPPORT
   wifi_config.ap.authmode = WIFI_AUTH_WPA3_PSK;
   wifi_config.ap.sae_pwe_h2e = WPA3_SAE_PWE_BOTH;
@@ -78,7 +110,11 @@ int NetworkServer::start()
     "wifi_init_softap finished. SSID:%s password:%s channel:%d",
     SSID, PASSWORD, CHANNEL);
 
-  //pthread_create(&server_pid,  NULL, server_thread,  this);
+  return 0;
+}
+
+int NetworkServer::start_network_thread()
+{
   pthread_create(&control_pid, NULL, control_thread, this);
 
   return 0;
@@ -115,237 +151,1362 @@ void NetworkServer::wifi_event_handler(
   }
 }
 
-#if 0
-void NetworkServer::server_response_status(int socket_id)
+void NetworkServer::set_score(int player, int hits)
+{
+  if (player < 1 || player > STATUS_PLAYERS) { return; }
+
+  pthread_mutex_lock(&lock);
+
+  bool is_changed = scores[player - 1] != hits;
+
+  if (is_changed)
+  {
+    scores[player - 1] = hits;
+    status_changed = true;
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  // Spectators are sent the change from the network thread.
+  if (is_changed) { reactor.wake(); }
+}
+
+void NetworkServer::set_current_player(int player, int hits)
+{
+  pthread_mutex_lock(&lock);
+
+  bool is_changed = current_player != player || current_hits != hits;
+
+  if (is_changed)
+  {
+    current_player = player;
+    current_hits = hits;
+    status_changed = true;
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  if (is_changed) { reactor.wake(); }
+}
+
+void NetworkServer::set_beacon_alive(int beacon, bool is_alive)
 {
-  char text[512];
-  char header[256];
-  char right[16];
-  char left[16];
+  if (beacon < 0 || beacon >= STATUS_PLAYERS) { return; }
 
-  right[0] = 0;
-  left[0] = 0;
+  pthread_mutex_lock(&lock);
+
+  if (beacon_alive[beacon] != is_alive)
+  {
+    beacon_alive[beacon] = is_alive;
+    status_changed = true;
+  }
+
+  pthread_mutex_unlock(&lock);
+}
+
+void NetworkServer::set_hole_counts(uint32_t glitches, uint32_t ignored)
+{
+  pthread_mutex_lock(&lock);
+
+  if (hole_glitches != glitches || hole_ignored != ignored)
+  {
+    hole_glitches = glitches;
+    hole_ignored = ignored;
+    status_changed = true;
+  }
+
+  pthread_mutex_unlock(&lock);
+}
+
+void NetworkServer::server_render()
+{
+  // The body is written after room for the header, then the header is
+  // put right in front of it so the response goes out in one send().
+  char *body = status_response + STATUS_HEADER_ROOM;
+  const int space = sizeof(status_response) - STATUS_HEADER_ROOM;
+  int length = 0;
+
+  pthread_mutex_lock(&lock);
+
+  if (! status_changed)
+  {
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+
+  length += snprintf(body + length, space - length, "{ \"players\": [");
+
+  for (int i = 0; i < STATUS_PLAYERS; i++)
+  {
+    length += snprintf(body + length, space - length,
+      "%s { \"player\": %d, \"hits\": %d, \"beacon\": %s }",
+      i == 0 ? "" : ",",
+      i + 1,
+      scores[i],
+      beacon_alive[i] ? "true" : "false");
+  }
+
+  length += snprintf(body + length, space - length,
+    " ], \"current_player\": %d, \"current_hits\": %d,"
+    " \"hole_glitches\": %d, \"hole_ignored\": %d,"
+    " \"connections\": %d, \"events\": %d, \"duplicates\": %d,"
+    " \"tees\": [",
+    current_player,
+    current_hits,
+    (int)hole_glitches,
+    (int)hole_ignored,
+    connection_count,
+    event_count,
+    duplicates);
+
+  status_changed = false;
+
+  pthread_mutex_unlock(&lock);
+
+  bool is_first = true;
+
+  for (int i = 0; i < MAX_CONNECTIONS && length < space; i++)
+  {
+    const Connection &connection = connections[i];
+
+    if (connection.transport == NULL) { continue; }
+
+    // Stored in network byte order.
+    const uint32_t address = connection.transport->get_address();
+
+    length += snprintf(body + length, space - length,
+      "%s { \"connection\": %d, \"address\": \"%d.%d.%d.%d\","
+      " \"events\": %d, \"synced\": %s }",
+      is_first ? "" : ",",
+      i,
+      (int)(address & 0xff),
+      (int)((address >> 8) & 0xff),
+      (int)((address >> 16) & 0xff),
+      (int)(address >> 24),
+      connection.events,
+      peers[connection.peer].clock.is_synced() ? "true" : "false");
+
+    is_first = false;
+  }
+
+  if (length < space)
+  {
+    length += snprintf(body + length, space - length,
+      " ], \"updated_ms\": %lld }\n",
+      esp_timer_get_time() / 1000);
+  }
 
-  sprintf(
-    text,
-    "{ "
-    " \"right_fault\": %s,"
-    " \"left_fault\": %s,"
-    "}",
-    right,
-    left,
+  if (length >= space)
+  {
+    // Doesn't happen while the STATUS_BODY_ sizes match the format
+    // strings above, but don't serve half a JSON object if it ever does.
+    length = snprintf(body, space, "{ \"error\": \"too long\" }\n");
+  }
 
-  int length = strlen(text);
+  char header[STATUS_HEADER_ROOM];
 
-  sprintf(
+  int header_length = snprintf(
     header,
-    "HTTP/1.1 200 OK\n"
-    "Cache-Control: no-cache, must-revalidate\n"
-    "Pragma: no-cache\n"
-    "Content-Type: text/html\n"
-    "Content-Length: %d\n\n",
+    sizeof(header),
+    "HTTP/1.1 200 OK\r\n"
+    "Cache-Control: no-cache, must-revalidate\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: %d\r\n"
+    "Connection: close\r\n\r\n",
     length);
 
-  Network::net_send(socket_id, (const uint8_t *)header, strlen(header));
-  Network::net_send(socket_id, (const uint8_t *)text, length);
+  status_start = STATUS_HEADER_ROOM - header_length;
+  status_length = header_length + length;
+
+  memcpy(status_response + status_start, header, header_length);
+}
+
+#ifdef HTTP_PORT
+int NetworkServer::server_open()
+{
+  struct sockaddr_in server_addr;
+
+  int socket_id = socket(AF_INET, SOCK_STREAM, 0);
+
+  if (socket_id < 0)
+  {
+    printf("Can't open HTTP socket.\n");
+    return -1;
+  }
+
+  memset((char*)&server_addr, 0, sizeof(server_addr));
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  server_addr.sin_port = htons(HTTP_PORT);
+
+  if (bind(socket_id, (const sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+  {
+    printf("Server can't bind HTTP.\n");
+    close(socket_id);
+    return -1;
+  }
+
+  if (listen(socket_id, MAX_HTTP_CLIENTS) != 0)
+  {
+    printf("HTTP listen failed.\n");
+    close(socket_id);
+    return -1;
+  }
+
+  fcntl(socket_id, F_SETFL, O_NONBLOCK);
+
+  return socket_id;
 }
-#endif
 
-#if 0
-int NetworkServer::server_get_response(int socket_id)
+void NetworkServer::server_accept(int listen_id)
 {
-  char buffer[32];
-  int response = 0;
+  struct sockaddr_in client_addr;
+
+  socklen_t n = sizeof(client_addr);
+  int client = accept(listen_id, (struct sockaddr *)&client_addr, &n);
 
+  if (client == -1) { return; }
+
+  // Someone refreshing the page in a tight loop only gets a couple of
+  // slots, the tees always come first.
+  if (server_clients == MAX_HTTP_CLIENTS)
+  {
+    net_close(client);
+    return;
+  }
+
+  fcntl(client, F_SETFL, O_NONBLOCK);
+
+  server_clients++;
+  scheduler.spawn(server_client_task(client));
+}
+
+Scheduler::Task NetworkServer::server_task(int listen_id)
+{
   while (true)
   {
-    int length = net_recv(socket_id, (uint8_t *)buffer, sizeof(buffer));
-    if (length <= 0) { return -1; }
+    int result = co_await scheduler.wait_socket(
+      listen_id,
+      Scheduler::WAIT_READ);
 
-    for (int n = 0; n < length; n++)
+    if (result == Scheduler::WAIT_ERROR)
     {
-      response = buffer[n];
+      ESP_LOGE("control_run", "Status page stopped, no reactor handler.");
+      break;
     }
 
-    if (response >= 1 && response <= 3) { break; }
+    server_accept(listen_id);
+  }
+}
+
+Scheduler::Task NetworkServer::server_client_task(int socket_id)
+{
+  const int64_t deadline = get_deadline(HTTP_TIMEOUT_MS);
+  char request[256];
+  int length = 0;
+  bool is_complete = false;
+
+  // Only the request line matters, the rest of the header is read so
+  // closing the socket doesn't reset the connection under the reply.
+  while (length < (int)sizeof(request) - 1)
+  {
+    int n;
+
+    Status status = net_recv_until(
+      socket_id,
+      (uint8_t *)request + length,
+      sizeof(request) - 1 - length,
+      0,
+      &n);
+
+    if (status == NET_OK)
+    {
+      length += n;
+      request[length] = 0;
+
+      if (strstr(request, "\r\n\r\n") != NULL)
+      {
+        is_complete = true;
+        break;
+      }
+
+      continue;
+    }
+
+    if (status != NET_TIMEOUT) { break; }
+
+    int64_t wait = deadline - esp_timer_get_time();
+
+    if (wait <= 0) { break; }
+
+    int result = co_await scheduler.wait_socket(
+      socket_id,
+      Scheduler::WAIT_READ,
+      (wait + 999) / 1000);
+
+    if (result == Scheduler::WAIT_ERROR) { break; }
+  }
+
+  request[length] = 0;
+
+  if (strncmp(request, "GET /events ", 12) == 0)
+  {
+    // The socket is handed over to a spectator task for as long as it
+    // stays connected.
+    server_clients--;
+    spectator_add(socket_id);
+    co_return;
+  }
+
+  const uint8_t *response = NULL;
+  int response_length = 0;
+
+  if (strncmp(request, "GET / ", 6) == 0 ||
+      strncmp(request, "GET /status ", 12) == 0)
+  {
+    // The cached page is only rebuilt when something on it changed, and
+    // never while another client is still part way through sending it.
+    if (server_sending == 0) { server_render(); }
+
+    response = (const uint8_t *)status_response + status_start;
+    response_length = status_length;
+  }
+    else
+  if (is_complete || length == (int)sizeof(request) - 1)
+  {
+    static const char not_found[] =
+      "HTTP/1.1 404 Not Found\r\n"
+      "Content-Length: 0\r\n"
+      "Connection: close\r\n\r\n";
+
+    response = (const uint8_t *)not_found;
+    response_length = sizeof(not_found) - 1;
+  }
+
+  server_sending++;
+
+  int sent = 0;
+
+  while (response != NULL && sent < response_length)
+  {
+    int n;
+
+    Status status = net_send_until(
+      socket_id,
+      response + sent,
+      response_length - sent,
+      0,
+      &n);
+
+    sent += n;
+
+    if (status == NET_OK) { break; }
+    if (status != NET_TIMEOUT) { break; }
+
+    int64_t wait = deadline - esp_timer_get_time();
+
+    if (wait <= 0) { break; }
+
+    int result = co_await scheduler.wait_socket(
+      socket_id,
+      Scheduler::WAIT_WRITE,
+      (wait + 999) / 1000);
+
+    if (result == Scheduler::WAIT_ERROR) { break; }
   }
 
-  return response;
+  server_sending--;
+  server_clients--;
+
+  net_close(socket_id);
+}
+
+void NetworkServer::spectator_add(int socket_id)
+{
+  int id = stream.subscribe();
+
+  if (id == -1)
+  {
+    static const char busy[] =
+      "HTTP/1.1 503 Service Unavailable\r\n"
+      "Content-Length: 0\r\n"
+      "Connection: close\r\n\r\n";
+
+    int n;
+
+    net_send_until(socket_id, (const uint8_t *)busy, sizeof(busy) - 1, 0, &n);
+    net_close(socket_id);
+    return;
+  }
+
+  ESP_LOGI("control_run", "Spectator %d id=%d", id, socket_id);
+
+  scheduler.spawn(spectator_task(id, socket_id));
 }
-#endif
 
-#if 0
-void NetworkServer::server_process(int socket_id)
+void NetworkServer::spectator_publish()
 {
-  char buffer[1];
+  int scores[STATUS_PLAYERS];
+  int player;
+  int hits;
 
+  pthread_mutex_lock(&lock);
+  memcpy(scores, this->scores, sizeof(scores));
+  player = current_player;
+  hits = current_hits;
+  pthread_mutex_unlock(&lock);
+
+  // Each change is encoded once no matter how many are watching, the
+  // spectators are then only told there is something new.
+  bool is_changed = false;
+
+  for (int i = 0; i < STATUS_PLAYERS; i++)
+  {
+    if (stream.set_score(i + 1, scores[i])) { is_changed = true; }
+  }
+
+  if (stream.set_current_player(player, hits)) { is_changed = true; }
+
+  if (! is_changed) { return; }
+
+  for (int i = 0; i < ScoreStream::MAX_SUBSCRIBERS; i++)
+  {
+    if (stream.is_active(i)) { spectator_ready[i].set(); }
+  }
+}
+
+void NetworkServer::on_wake(void *context)
+{
+  NetworkServer *network_server = (NetworkServer *)context;
+  network_server->spectator_publish();
+}
+
+Scheduler::Task NetworkServer::spectator_task(int id, int socket_id)
+{
   while (true)
   {
-    int length = net_recv(socket_id, (uint8_t *)buffer, sizeof(buffer));
+    const uint8_t *data;
+    int length;
+
+    if (stream.get_pending(id, &data, &length) != ScoreStream::STREAM_OK)
+    {
+      ESP_LOGW("control_run", "Spectator %d fell behind, dropped.", id);
+      break;
+    }
+
+    if (length != 0)
+    {
+      int n;
+
+      Status status = net_send_until(socket_id, data, length, 0, &n);
+
+      stream.consume(id, n);
+
+      if (status == NET_OK) { continue; }
+      if (status != NET_TIMEOUT) { break; }
+
+      // A slow spectator only ever has its own socket buffer full, the
+      // updates it hasn't taken yet stay in the shared ring.
+      int result = co_await scheduler.wait_socket(
+        socket_id,
+        Scheduler::WAIT_WRITE,
+        SPECTATOR_TIMEOUT_MS);
+
+      if (result == Scheduler::WAIT_TIMEOUT)
+      {
+        ESP_LOGW("control_run", "Spectator %d stalled, dropped.", id);
+        break;
+      }
+
+      if (result == Scheduler::WAIT_ERROR) { break; }
+
+      continue;
+    }
 
-    if (reponse < 0) { return; }
+    // Caught up. Reading is only to notice the spectator going away.
+    int result = co_await scheduler.wait_socket_or_signal(
+      socket_id,
+      Scheduler::WAIT_READ,
+      spectator_ready[id],
+      SPECTATOR_KEEPALIVE_MS);
+
+    if (result == Scheduler::WAIT_ERROR) { break; }
+
+    if (result == Scheduler::WAIT_TIMEOUT)
+    {
+      stream.keepalive(id);
+    }
+      else
+    if ((result & Scheduler::WAIT_READ) != 0)
+    {
+      uint8_t buffer[16];
+      int n;
+
+      Status status =
+        net_recv_until(socket_id, buffer, sizeof(buffer), 0, &n);
+
+      if (status != NET_OK && status != NET_TIMEOUT) { break; }
+    }
   }
+
+  ESP_LOGI("control_run", "Spectator %d left.", id);
+
+  stream.unsubscribe(id);
+  net_close(socket_id);
 }
 #endif
 
-#if 0
-void NetworkServer::server_run()
+int NetworkServer::control_open()
 {
   struct sockaddr_in server_addr;
-  struct sockaddr_in client_addr;
 
   int socket_id = socket(AF_INET, SOCK_STREAM, 0);
 
   if (socket_id < 0)
   {
     printf("Can't open socket.\n");
-    return;
+    return -1;
   }
 
   memset((char*)&server_addr, 0, sizeof(server_addr));
   server_addr.sin_family = AF_INET;
   server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-  server_addr.sin_port = htons(HTTP_PORT);
+  server_addr.sin_port = htons(CONTROL_PORT);
 
   if (bind(socket_id, (const sockaddr *)&server_addr, sizeof(server_addr)) < 0)
   {
     printf("Server can't bind.\n");
-    return;
+    close(socket_id);
+    return -1;
   }
 
-  if (listen(socket_id, 1) != 0)
+  if (listen(socket_id, MAX_CONNECTIONS) != 0)
   {
     printf("Listen failed.\n");
+    close(socket_id);
+    return -1;
+  }
+
+  fcntl(socket_id, F_SETFL, O_NONBLOCK);
+
+  return socket_id;
+}
+
+void NetworkServer::control_accept(int listen_id)
+{
+  struct sockaddr_in client_addr;
+
+  socklen_t n = sizeof(client_addr);
+  int client = accept(listen_id, (struct sockaddr *)&client_addr, &n);
+
+  if (client == -1) { return; }
+
+  int index = find_free_connection();
+
+  if (index == -1)
+  {
+    ESP_LOGW("control_run", "Too many connections, dropping socket_id=%d",
+      client);
+
+    Network::net_close(client);
     return;
   }
 
-  while (true)
+  Connection &connection = connections[index];
+
+  connection.tcp.attach(client, client_addr.sin_addr.s_addr);
+  control_add(index, &connection.tcp);
+}
+
+int NetworkServer::find_free_connection()
+{
+  for (int i = 0; i < MAX_CONNECTIONS; i++)
   {
-    socklen_t n = sizeof(client_addr);
-    int client = accept(socket_id, (struct sockaddr *)&client_addr, &n);
+    if (connections[i].transport == NULL) { return i; }
+  }
+
+  return -1;
+}
+
+void NetworkServer::control_add(int index, Transport *transport)
+{
+  Connection &connection = connections[index];
 
-    if (client == -1) { continue; }
-    fcntl(client, F_SETFL, O_NONBLOCK);
+  connection.transport = transport;
+  connection.peer = -1;
+  connection.peer = find_peer(transport->get_address());
 
-    server_process(client);
-    Network::net_close(client);
+  // Can't happen since there are as many peers as connections and this
+  // one wasn't using any, but then the tee would be without dedup.
+  if (connection.peer == -1)
+  {
+    ESP_LOGE("control_run", "No free peer for connection %d.", index);
+    transport->close();
+    connection.transport = NULL;
+    return;
   }
+  connection.length = 0;
+  connection.sequence = 0;
+  connection.bytes = 0;
+  connection.events = 0;
+  connection.last_heard = esp_timer_get_time();
+  connection.frames = 0;
+  connection.cycles = 0;
+
+  pthread_mutex_lock(&lock);
+  connection_count++;
+  status_changed = true;
+  pthread_mutex_unlock(&lock);
+
+  ESP_LOGI("control_run", "New connection %d id=%d", index,
+    transport->get_id());
+
+  scheduler.spawn(connection_task(index));
+}
+
+int NetworkServer::control_process(int index)
+{
+  Connection &connection = connections[index];
+  Batch batch = { };
+
+  // Cycles per frame from the first read to the reply going out, to
+  // compare the socket and netconn paths on real hardware.
+  const uint32_t start = esp_cpu_get_cycle_count();
+
+  int error = connection.transport->has_view() ?
+    control_receive_view(index, batch) :
+    control_receive(index, batch);
+
+  if (error != 0) { return -1; }
+
+  // One cumulative ack covers every event in this batch, and one
+  // heartbeat answers however many came in with it.
+  uint8_t buffer[Protocol::ACK_SIZE + Protocol::HEARTBEAT_REPLY_SIZE];
+  int length = 0;
+
+  if (batch.events != 0)
+  {
+    connection.events += batch.events;
+
+    length += Protocol::encode_ack(
+      buffer + length,
+      sizeof(buffer) - length,
+      connection.sequence++,
+      esp_timer_get_time(),
+      batch.acked);
+  }
+
+  if (batch.heartbeats != 0)
+  {
+    length += Protocol::encode_heartbeat_reply(
+      buffer + length,
+      sizeof(buffer) - length,
+      connection.sequence++,
+      esp_timer_get_time(),
+      batch.t1,
+      batch.t2);
+  }
+
+  if (length != 0)
+  {
+    // The reply is tiny so it only fails to go out if the tee stopped
+    // reading. Waiting longer than ACK_TIMEOUT_MS would hold up every
+    // other tee on this thread.
+    int sent;
+
+    Status status = connection.transport->send(
+      buffer,
+      length,
+      get_deadline(ACK_TIMEOUT_MS),
+      &sent);
+
+    if (status != NET_OK)
+    {
+      ESP_LOGE("control_run", "Ack on connection %d: %s.",
+        index, get_status_name(status));
+      return -1;
+    }
+  }
+
+  connection.cycles += esp_cpu_get_cycle_count() - start;
+  connection.frames += batch.frames;
+
+  if (connection.frames / BENCHMARK_FRAMES !=
+      (connection.frames - batch.frames) / BENCHMARK_FRAMES)
+  {
+    ESP_LOGI("control_run", "Connection %d: %d frames, %d cycles/frame (%s).",
+      index,
+      connection.frames,
+      (int)(connection.cycles / connection.frames),
+      connection.transport->has_view() ? "netconn" : "socket");
+  }
+
+  return 0;
 }
-#endif
 
-void NetworkServer::control_process(int socket_id)
+int NetworkServer::control_receive(int index, Batch &batch)
 {
-  int n;
-  uint8_t buffer[1];
-  struct timeval tv;
-  fd_set readset;
+  Connection &connection = connections[index];
+
+  while (true)
+  {
+    // One poll() takes everything that's waiting (up to the space left
+    // in the buffer) instead of a syscall per byte.
+    const int space = sizeof(connection.buffer) - connection.length;
+
+    int n;
+
+    Status status = connection.transport->poll(
+      connection.buffer + connection.length,
+      space,
+      &n);
+
+    if (status == NET_TIMEOUT) { break; }
+    if (status != NET_OK) { return -1; }
+
+    connection.length += n;
+    connection.bytes += n;
+    connection.last_heard = esp_timer_get_time();
+
+    batch.rx_time = connection.last_heard;
+
+    // Pull every complete frame out of the buffer in one pass, then move
+    // a trailing partial frame (if any) to the front once.
+    int offset =
+      control_frames(index, connection.buffer, connection.length, batch);
+
+    if (offset < 0) { return -1; }
+
+    if (offset != 0)
+    {
+      connection.length -= offset;
+      memmove(connection.buffer, connection.buffer + offset, connection.length);
+    }
+
+    // A short read means the socket is drained.
+    if (n < space) { break; }
+  }
+
+  return 0;
+}
 
-  control_socket_id = socket_id;
+int NetworkServer::control_receive_view(int index, Batch &batch)
+{
+  Connection &connection = connections[index];
 
   while (true)
   {
-    //length = 0;
+    const uint8_t *data;
+    int count;
+
+    Status status = connection.transport->poll_view(&data, &count);
 
-    //while (length < 5)
+    if (status == NET_TIMEOUT) { break; }
+    if (status != NET_OK) { return -1; }
+
+    connection.bytes += count;
+    connection.last_heard = esp_timer_get_time();
+
+    batch.rx_time = connection.last_heard;
+
+    // Frames are decoded where they sit in the pbuf. Only a frame split
+    // across two pbufs is put together in connection.buffer.
+    int used = 0;
+
+    if (connection.length != 0)
     {
-      FD_ZERO(&readset);
-      FD_SET(socket_id, &readset);
+      const int frame_length = connection.buffer[0] + 1;
 
-      tv.tv_sec = 2;
-      tv.tv_usec = 0;
+      if (frame_length > (int)sizeof(connection.buffer)) { return -1; }
 
-      n = select(socket_id + 1, &readset, NULL, NULL, &tv);
+      int n = frame_length - connection.length;
+      if (n > count) { n = count; }
 
-      if (n == -1)
+      memcpy(connection.buffer + connection.length, data, n);
+      connection.length += n;
+      used = n;
+
+      if (connection.length == frame_length)
       {
-        if (errno == EINTR) { continue; }
-        return;
+        if (control_frames(index, connection.buffer, frame_length, batch) < 0)
+        {
+          return -1;
+        }
+
+        connection.length = 0;
       }
+    }
 
-      // Timeout on select().
-      if (n == 0) { continue; }
+    if (connection.length == 0)
+    {
+      int offset = control_frames(index, data + used, count - used, batch);
 
-      //n = recv(socket_id, buffer + length, sizeof(buffer) - length, 0);
-      n = recv(socket_id, buffer, sizeof(buffer), 0);
+      if (offset < 0) { return -1; }
 
-      ESP_LOGI("control_run", "Read %d bytes %02x.", n, buffer[0]);
+      used += offset;
 
-      if (n == 0) { continue; }
+      // The start of a frame that continues in the next pbuf.
+      connection.length = count - used;
+      memcpy(connection.buffer, data + used, connection.length);
+    }
 
-      if (n < 0)
-      {
-        if (errno == ENOTCONN) { return; }
-        continue;
-      }
+    connection.transport->consume(count);
+  }
+
+  return 0;
+}
 
-      if (buffer[0] >= 1 && buffer[0] <= 3)
+int NetworkServer::control_frames(
+  int index,
+  const uint8_t *data,
+  int length,
+  Batch &batch)
+{
+  Connection &connection = connections[index];
+
+  // Returns the number of bytes of complete frames, anything after that
+  // is the start of a frame that hasn't all arrived yet.
+  int offset = 0;
+
+  while (true)
+  {
+    Protocol::Message message;
+
+    int used = Protocol::decode(data + offset, length - offset, message);
+
+    if (used < 0)
+    {
+      ESP_LOGE("control_run", "Bad frame on connection %d.", index);
+      return -1;
+    }
+
+    if (used == 0) { break; }
+
+    offset += used;
+    batch.frames++;
+
+    int64_t clock_offset;
+    uint32_t uncertainty;
+    int32_t drift_ppb;
+
+    int error = Protocol::decode_heartbeat(
+      message,
+      clock_offset,
+      uncertainty,
+      drift_ppb);
+
+    if (error == 0)
+    {
+      // The reply lets the tee measure the offset, and the tee sends
+      // back what it measured.
+      batch.t1 = message.timestamp;
+      batch.t2 = batch.rx_time;
+      batch.heartbeats++;
+
+      if (uncertainty != Protocol::UNCERTAINTY_UNKNOWN)
       {
-        set_player(buffer[0]);
+        pthread_mutex_lock(&lock);
+        peers[connection.peer].clock.set_estimate(
+          batch.t1,
+          clock_offset,
+          uncertainty,
+          drift_ppb);
+        pthread_mutex_unlock(&lock);
       }
 
-      //length += n;
+      continue;
+    }
+
+    if (process_start_player(message, connection.peer, index))
+    {
+      batch.acked = message.sequence;
+      batch.events++;
     }
   }
 
-  control_socket_id = -1;
+  return offset;
 }
 
-void NetworkServer::control_run()
+void NetworkServer::control_close(int index)
+{
+  Connection &connection = connections[index];
+
+  ESP_LOGI("control_run",
+    "Disconnect %d after %d events, %d bytes, %d cycles/frame.",
+    index, connection.events, connection.bytes,
+    connection.frames != 0 ? (int)(connection.cycles / connection.frames) : 0);
+
+  connection.transport->close();
+
+  connection.transport = NULL;
+  connection.peer = -1;
+  connection.length = 0;
+
+  pthread_mutex_lock(&lock);
+  connection_count--;
+  status_changed = true;
+  pthread_mutex_unlock(&lock);
+}
+
+int NetworkServer::udp_open()
 {
   struct sockaddr_in server_addr;
-  struct sockaddr_in client_addr;
 
-  int socket_id = socket(AF_INET, SOCK_STREAM, 0);
+  int socket_id = socket(AF_INET, SOCK_DGRAM, 0);
 
   if (socket_id < 0)
   {
-    printf("Can't open socket.\n");
-    return;
+    printf("Can't open UDP socket.\n");
+    return -1;
   }
 
   memset((char*)&server_addr, 0, sizeof(server_addr));
   server_addr.sin_family = AF_INET;
   server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-  server_addr.sin_port = htons(CONTROL_PORT);
+  server_addr.sin_port = htons(CONTROL_UDP_PORT);
 
   if (bind(socket_id, (const sockaddr *)&server_addr, sizeof(server_addr)) < 0)
   {
-    printf("Server can't bind.\n");
-    return;
+    printf("Server can't bind UDP.\n");
+    close(socket_id);
+    return -1;
   }
 
-  if (listen(socket_id, 1) != 0)
+  fcntl(socket_id, F_SETFL, O_NONBLOCK);
+
+  return socket_id;
+}
+
+void NetworkServer::udp_process(int udp_id)
+{
+  struct sockaddr_in client_addr;
+  uint8_t buffer[Protocol::MAX_FRAME * 8];
+
+  while (true)
   {
-    printf("Listen failed.\n");
-    return;
+    socklen_t addr_length = sizeof(client_addr);
+
+    int n = recvfrom(
+      udp_id,
+      buffer,
+      sizeof(buffer),
+      0,
+      (struct sockaddr *)&client_addr,
+      &addr_length);
+
+    if (n <= 0) { return; }
+
+    int peer = find_peer(client_addr.sin_addr.s_addr);
+
+    // Every peer belongs to an open connection, there's no room for
+    // another tee.
+    if (peer == -1) { continue; }
+
+    int connection = -1;
+    int events = 0;
+    int offset = 0;
+
+    for (int i = 0; i < MAX_CONNECTIONS; i++)
+    {
+      if (connections[i].transport != NULL && connections[i].peer == peer)
+      {
+        connection = i;
+        break;
+      }
+    }
+
+    // A datagram holds whole frames, anything that doesn't decode is
+    // dropped and left to the tee's retransmit.
+    while (offset < n)
+    {
+      Protocol::Message message;
+
+      int used = Protocol::decode(buffer + offset, n - offset, message);
+
+      if (used <= 0) { break; }
+
+      offset += used;
+
+      if (process_start_player(message, peer, connection)) { events++; }
+    }
+
+    if (events == 0) { continue; }
+
+    // The selective ack also covers events that were duplicates, which
+    // means the earlier ack was lost.
+    const Peer &p = peers[peer];
+    uint8_t sack[Protocol::SACK_SIZE];
+
+    int length = Protocol::encode_sack(
+      sack,
+      sizeof(sack),
+      udp_sequence++,
+      esp_timer_get_time(),
+      p.highest,
+      p.window);
+
+    sendto(
+      udp_id,
+      sack,
+      length,
+      0,
+      (struct sockaddr *)&client_addr,
+      addr_length);
+  }
+}
+
+int NetworkServer::find_peer(uint32_t address)
+{
+  int oldest = -1;
+
+  for (int i = 0; i < MAX_CONNECTIONS; i++)
+  {
+    if (peers[i].address == address)
+    {
+      peers[i].last_seen = esp_timer_get_time();
+      return i;
+    }
+
+    // A peer an open connection still points to keeps its sequence
+    // window and clock, only idle ones are taken over.
+    if (is_peer_in_use(i)) { continue; }
+
+    if (oldest == -1 || peers[i].last_seen < peers[oldest].last_seen)
+    {
+      oldest = i;
+    }
+  }
+
+  if (oldest == -1) { return -1; }
+
+  // Unused entries have last_seen 0 so they are taken first.
+  Peer &peer = peers[oldest];
+
+  peer.address      = address;
+  peer.has_sequence = false;
+  peer.highest      = 0;
+  peer.window       = 0;
+  peer.last_seen    = esp_timer_get_time();
+
+  pthread_mutex_lock(&lock);
+  peer.clock.reset();
+  pthread_mutex_unlock(&lock);
+
+  return oldest;
+}
+
+bool NetworkServer::is_peer_in_use(int index)
+{
+  for (int i = 0; i < MAX_CONNECTIONS; i++)
+  {
+    if (connections[i].transport != NULL && connections[i].peer == index)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool NetworkServer::is_duplicate(int index, uint16_t sequence)
+{
+  Peer &peer = peers[index];
+
+  if (! peer.has_sequence)
+  {
+    peer.has_sequence = true;
+    peer.highest = sequence;
+    peer.window = 0;
+    return false;
+  }
+
+  int diff = (int16_t)(sequence - peer.highest);
+
+  if (diff == 0) { return true; }
+
+  if (diff > 0)
+  {
+    // Newer than anything seen, slide the window.
+    if (diff > 32)
+    {
+      peer.window = 0;
+    }
+      else
+    if (diff == 32)
+    {
+      peer.window = 1u << 31;
+    }
+      else
+    {
+      peer.window = (peer.window << diff) | (1u << (diff - 1));
+    }
+
+    peer.highest = sequence;
+
+    return false;
+  }
+
+  int n = -diff - 1;
+
+  if (n >= 32)
+  {
+    // Far older than the window, most likely the tee restarted.
+    peer.highest = sequence;
+    peer.window = 0;
+    return false;
+  }
+
+  if ((peer.window & (1u << n)) != 0) { return true; }
+
+  peer.window |= 1u << n;
+
+  return false;
+}
+
+bool NetworkServer::process_start_player(
+  const Protocol::Message &message,
+  int peer,
+  int connection)
+{
+  int player;
+
+  if (Protocol::decode_start_player(message, player) != 0) { return false; }
+
+  if (is_duplicate(peer, message.sequence))
+  {
+    pthread_mutex_lock(&lock);
+    duplicates++;
+    status_changed = true;
+    pthread_mutex_unlock(&lock);
+
+    if (log_limit.allow())
+    {
+      ESP_LOGI("control_run",
+        "Peer %d seq=%d duplicate (%d total, %d not logged).",
+        peer, message.sequence, duplicates, log_limit.take_suppressed());
+    }
+
+    return true;
+  }
+
+  if (log_limit.allow())
+  {
+    // Time from the tap on the tee to now, in base time. The peer's
+    // clock is kept in tee time (the tee sends its estimate), so it's
+    // asked about the tee's now.
+    ClockSync &clock = peers[peer].clock;
+    int64_t now = esp_timer_get_time();
+    int64_t latency = now - clock.to_remote(message.timestamp);
+
+    ESP_LOGI("control_run",
+      "Peer %d connection %d seq=%d player=%d latency=%lld us +/-%lld "
+      "(%d not logged).",
+      peer, connection, message.sequence, player,
+      clock.is_synced() ? latency : -1,
+      clock.get_uncertainty(clock.to_local(now)),
+      log_limit.take_suppressed());
+  }
+
+  pthread_mutex_lock(&lock);
+  event_count++;
+  status_changed = true;
+  pthread_mutex_unlock(&lock);
+
+  if (player >= 1 && player <= MAX_PLAYERS)
+  {
+    // Stamped with the time of the tap in base time when the tee's clock
+    // is known.
+    ClockSync &clock = peers[peer].clock;
+
+    events.push(
+      EventQueue::EVENT_START_PLAYER,
+      connection,
+      player,
+      clock.is_synced() ?
+        clock.to_remote(message.timestamp) : esp_timer_get_time());
+  }
+
+  return true;
+}
+
+int64_t NetworkServer::get_clock_offset(int connection, int64_t *uncertainty)
+{
+  int64_t now = esp_timer_get_time();
+  int64_t offset = 0;
+
+  if (uncertainty != NULL) { *uncertainty = -1; }
+
+  pthread_mutex_lock(&lock);
+
+  int peer = connection >= 0 && connection < MAX_CONNECTIONS ?
+    connections[connection].peer : -1;
+
+  if (peer != -1)
+  {
+    // The estimate came from the tee, so it's indexed by tee time.
+    ClockSync &clock = peers[peer].clock;
+    int64_t tee_now = clock.to_local(now);
+
+    offset = clock.get_offset(tee_now);
+
+    if (uncertainty != NULL)
+    {
+      *uncertainty = clock.get_uncertainty(tee_now);
+    }
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  return offset;
+}
+
+Scheduler::Task NetworkServer::accept_task(int listen_id)
+{
+  while (true)
+  {
+    int result = co_await scheduler.wait_socket(
+      listen_id,
+      Scheduler::WAIT_READ);
+
+    if (result == Scheduler::WAIT_ERROR)
+    {
+      ESP_LOGE("control_run", "Not accepting tees, no reactor handler.");
+      break;
+    }
+
+    control_accept(listen_id);
   }
+}
 
+Scheduler::Task NetworkServer::connection_task(int index)
+{
+  Connection &connection = connections[index];
+
+  // One of these per tee, it ends when the tee disconnects. A tee that
+  // goes quiet (power loss, out of range) is dropped after it misses
+  // its heartbeats instead of whenever TCP gives up on it.
   while (true)
   {
-    socklen_t n = sizeof(client_addr);
-    int client = accept(socket_id, (struct sockaddr *)&client_addr, &n);
+    int64_t wait = get_dead_time(connection.last_heard) - esp_timer_get_time();
+
+    if (wait <= 0)
+    {
+      ESP_LOGW("control_run", "Connection %d missed %d heartbeats.",
+        index, HEARTBEAT_MISSES);
+      break;
+    }
 
-    if (client == -1) { continue; }
-    fcntl(client, F_SETFL, O_NONBLOCK);
+    int result = co_await scheduler.wait_socket(
+      connection.transport->get_id(),
+      Scheduler::WAIT_READ,
+      (wait + 999) / 1000);
 
-    ESP_LOGI("control_run", "New connection socket_id=%d", client);
-    control_process(client);
-    ESP_LOGI("control_run", "Disconnect.");
+    if (result == Scheduler::WAIT_TIMEOUT) { continue; }
 
-    Network::net_close(client);
+    // Without its timeout a dead tee would never be noticed.
+    if (result == Scheduler::WAIT_ERROR)
+    {
+      ESP_LOGE("control_run", "Connection %d can't wait, dropped.", index);
+      break;
+    }
+
+    if (control_process(index) != 0) { break; }
   }
+
+  control_close(index);
 }
 
-#if 0
-void *NetworkServer::server_thread(void *context)
+Scheduler::Task NetworkServer::udp_task(int udp_id)
 {
-  NetworkServer *network_server = (NetworkServer *)context;
-  network_server->server_run();
+  while (true)
+  {
+    int result = co_await scheduler.wait_socket(
+      udp_id,
+      Scheduler::WAIT_READ);
 
-  return NULL;
+    if (result == Scheduler::WAIT_ERROR)
+    {
+      ESP_LOGE("control_run", "UDP stopped, no reactor handler.");
+      break;
+    }
+
+    udp_process(udp_id);
+  }
+}
+
+#ifdef CONTROL_NETCONN
+Scheduler::Task NetworkServer::netconn_accept_task()
+{
+  while (true)
+  {
+    int result = co_await scheduler.wait_socket(
+      listener.get_id(),
+      Scheduler::WAIT_READ);
+
+    if (result == Scheduler::WAIT_ERROR)
+    {
+      ESP_LOGE("control_run", "Not accepting tees, no reactor handler.");
+      break;
+    }
+
+    while (true)
+    {
+      int index = find_free_connection();
+
+      NetconnTransport &client =
+        index == -1 ? rejected : connections[index].netconn;
+
+      if (listener.accept(client) != 0) { break; }
+
+      if (index == -1)
+      {
+        ESP_LOGW("control_run", "Too many connections, dropping one.");
+        client.close();
+        continue;
+      }
+
+      control_add(index, &client);
+    }
+  }
 }
 #endif
 
+void NetworkServer::control_run()
+{
+#ifdef HTTP_PORT
+  if (reactor.open(on_wake, this) != 0) { return; }
+#else
+  if (reactor.open() != 0) { return; }
+#endif
+
+#ifdef CONTROL_NETCONN
+  if (listener.listen(CONTROL_PORT) != 0) { return; }
+
+  scheduler.spawn(netconn_accept_task());
+#else
+  int listen_id = control_open();
+
+  if (listen_id < 0) { return; }
+
+  scheduler.spawn(accept_task(listen_id));
+#endif
+
+  int udp_id = udp_open();
+
+  if (udp_id != -1) { scheduler.spawn(udp_task(udp_id)); }
+
+#ifdef HTTP_PORT
+  // The status page is served from the same loop as the tees, but only
+  // ever does non-blocking socket calls so it can't hold them up.
+  int http_id = server_open();
+
+  if (http_id != -1) { scheduler.spawn(server_task(http_id)); }
+#endif
+
+  // Every tee (TCP and UDP) is served by coroutines on this one thread.
+  reactor.run();
+}
+
 void *NetworkServer::control_thread(void *context)
 {
   NetworkServer *network_server = (NetworkServer *)context;
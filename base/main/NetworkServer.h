@@ -15,41 +15,66 @@
 #define NETWORK_SERVER_H
 
 #include <pthread.h>
+#include <sys/socket.h>
 
 #include "esp_event.h"
 #include "esp_wifi.h"
 
+#include "defines.h"
+#include "ClockSync.h"
+#include "EventQueue.h"
+#include "LogLimit.h"
 #include "Network.h"
+#ifdef CONTROL_NETCONN
+#include "NetconnTransport.h"
+#endif
+#include "Protocol.h"
+#include "Reactor.h"
+#include "Scheduler.h"
+#include "ScoreStream.h"
+#include "SocketTransport.h"
+#include "Transport.h"
 
 class NetworkServer : public Network
 {
 public:
-  NetworkServer();
+  NetworkServer(EventQueue &events);
   ~NetworkServer();
 
   int start();
+  int start_wifi();
+  int start_network_thread();
   int send_start_race();
 
-  bool is_connected() { return control_socket_id != -1; }
-
-  void set_player(int value)
+  bool is_connected()
   {
+    int count;
+
     pthread_mutex_lock(&lock);
-    player = value;
+    count = connection_count;
     pthread_mutex_unlock(&lock);
+
+    return count != 0;
   }
 
-  int get_player()
-  {
-    int value;
+  // What the status page shows of the game, player is 1 to MAX_PLAYERS
+  // (0 for no current player). The cached page is only re-rendered when
+  // one of these actually changes.
+  void set_score(int player, int hits);
+  void set_current_player(int player, int hits);
+  void set_beacon_alive(int beacon, bool is_alive);
+  void set_hole_counts(uint32_t glitches, uint32_t ignored);
 
-    pthread_mutex_lock(&lock);
-    value = player;
-    player = 0; 
-    pthread_mutex_unlock(&lock);
+  // Offset of a tee's clock in microseconds, base time minus tee time.
+  // uncertainty is -1 until the tee has synced.
+  int64_t get_clock_offset(int connection, int64_t *uncertainty = NULL);
 
-    return value;
-  }
+  // Matches wifi_config.ap.max_connection, one tee per station.
+  static const int MAX_CONNECTIONS = 8;
+
+  // The reactor, the netconn listener and rejecter, and one eventfd per
+  // netconn connection.
+  static_assert(EVENTFD_MAX >= MAX_CONNECTIONS + 3);
 
 private:
   static void wifi_event_handler(
@@ -58,22 +83,190 @@ private:
     int32_t event_id,
     void *event_data);
 
-  //int server_get_response(int socket_id);
-  //void server_process(int socket_id);
-  //void server_run();
+  struct Connection
+  {
+    Connection() :
+      tcp        { SOCK_STREAM },
+      transport  { NULL },
+      peer       { -1 },
+      length     { 0 },
+      sequence   { 0 },
+      bytes      { 0 },
+      events     { 0 },
+      last_heard { 0 },
+      frames     { 0 },
+      cycles     { 0 }
+    {
+    }
+
+    SocketTransport tcp;
+#ifdef CONTROL_NETCONN
+    NetconnTransport netconn;
+#endif
+    Transport *transport;
+    int peer;
+    int length;
+    uint16_t sequence;
+    int bytes;
+    int events;
+    int64_t last_heard;
+    int frames;
+    uint64_t cycles;
+    uint8_t buffer[128];
+  };
+
+  // What one pass over a connection's input needs for the reply.
+  struct Batch
+  {
+    int frames;
+    int events;
+    int heartbeats;
+    uint16_t acked;
+    int64_t rx_time;
+    int64_t t1;
+    int64_t t2;
+  };
+
+  // A tee, keyed by IP address. The same tee can send an event over UDP
+  // and then again over TCP, so duplicates are tracked here rather than
+  // per socket. Bit n of window is set if sequence highest - 1 - n was
+  // already seen. clock maps the tee's timestamps into base time.
+  struct Peer
+  {
+    Peer() :
+      address      { 0 },
+      has_sequence { false },
+      highest      { 0 },
+      window       { 0 },
+      last_seen    { 0 }
+    {
+    }
+
+    uint32_t address;
+    bool has_sequence;
+    uint16_t highest;
+    uint32_t window;
+    int64_t last_seen;
+    ClockSync clock;
+  };
 
-  void control_process(int socket_id);
+  int control_open();
+  void control_accept(int listen_id);
+  int find_free_connection();
+  void control_add(int index, Transport *transport);
+  int control_process(int index);
+  int control_receive(int index, Batch &batch);
+  int control_receive_view(int index, Batch &batch);
+
+  int control_frames(
+    int index,
+    const uint8_t *data,
+    int length,
+    Batch &batch);
+
+  void control_close(int index);
+  int udp_open();
+  void udp_process(int udp_id);
+  int find_peer(uint32_t address);
+  bool is_peer_in_use(int index);
+  bool is_duplicate(int index, uint16_t sequence);
+  bool process_start_player(
+    const Protocol::Message &message,
+    int peer,
+    int connection);
+  Scheduler::Task accept_task(int listen_id);
+#ifdef CONTROL_NETCONN
+  Scheduler::Task netconn_accept_task();
+#endif
+  Scheduler::Task connection_task(int index);
+  Scheduler::Task udp_task(int udp_id);
   void control_run();
 
-  //static void *server_thread(void *context);
+  void server_render();
+#ifdef HTTP_PORT
+  int server_open();
+  void server_accept(int listen_id);
+  Scheduler::Task server_task(int listen_id);
+  Scheduler::Task server_client_task(int socket_id);
+  void spectator_add(int socket_id);
+  void spectator_publish();
+  Scheduler::Task spectator_task(int id, int socket_id);
+  static void on_wake(void *context);
+#endif
+
   static void *control_thread(void *context);
 
-  //pthread_t server_pid;
   pthread_t control_pid;
   pthread_mutex_t lock;
 
-  int control_socket_id;
-  int player;
+  // Every connection, HTTP client and spectator has a socket and most
+  // of them a timer.
+  static const int REACTOR_HANDLERS = 32;
+  static const int REACTOR_TIMERS = 32;
+
+  Reactor reactor;
+  Scheduler scheduler;
+  Connection connections[MAX_CONNECTIONS];
+  Peer peers[MAX_CONNECTIONS];
+  int connection_count;
+  int event_count;
+  int duplicates;
+  LogLimit log_limit;
+  uint16_t udp_sequence;
+#ifdef CONTROL_NETCONN
+  NetconnTransport listener;
+  NetconnTransport rejected;
+#endif
+
+  // Event log lines per second before they are only counted.
+  static const int LOG_LIMIT = 5;
+  static const int ACK_TIMEOUT_MS = 50;
+
+  // Frames between cycle count log lines.
+  static const int BENCHMARK_FRAMES = 1000;
+
+  // Start player events go to the game loop through here.
+  EventQueue &events;
+
+  // Status page state, the game values and status_changed are under
+  // lock. The response is pre-rendered into status_response.
+  static const int STATUS_PLAYERS = MAX_PLAYERS;
+  static const int STATUS_HEADER_ROOM = 160;
+
+  // Longest the status page body can get, with every number at its
+  // widest: the fields around the two lists, then each player and each
+  // tee entry. Update these with the format strings in server_render().
+  static const int STATUS_BODY_FIXED = 272;
+  static const int STATUS_BODY_PLAYER = 72;
+  static const int STATUS_BODY_TEE = 104;
+  static const int STATUS_BODY_SIZE =
+    STATUS_BODY_FIXED +
+    STATUS_BODY_PLAYER * STATUS_PLAYERS +
+    STATUS_BODY_TEE * MAX_CONNECTIONS;
+
+  static const int MAX_HTTP_CLIENTS = 2;
+  static const int HTTP_TIMEOUT_MS = 2000;
+
+  int scores[STATUS_PLAYERS];
+  bool beacon_alive[STATUS_PLAYERS];
+  int current_player;
+  int current_hits;
+  uint32_t hole_glitches;
+  uint32_t hole_ignored;
+  bool status_changed;
+  int status_start;
+  int status_length;
+  int server_clients;
+  int server_sending;
+  char status_response[STATUS_HEADER_ROOM + STATUS_BODY_SIZE];
+
+  // Spectators following the scores on GET /events. One that can't take
+  // any data for SPECTATOR_TIMEOUT_MS is dropped.
+  static const int SPECTATOR_TIMEOUT_MS = 5000;
+  static const int SPECTATOR_KEEPALIVE_MS = 15000;
+
+  ScoreStream stream;
+  Scheduler::Signal spectator_ready[ScoreStream::MAX_SUBSCRIBERS];
 };
 
 #endif
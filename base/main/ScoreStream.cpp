@@ -0,0 +1,201 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ScoreStream.h"
+
+ScoreStream::ScoreStream() :
+  head           { 0 },
+  current_player { 0 },
+  current_hits   { 0 }
+{
+  memset(ring, 0, sizeof(ring));
+  memset(subscribers, 0, sizeof(subscribers));
+  memset(scores, 0, sizeof(scores));
+}
+
+ScoreStream::~ScoreStream()
+{
+}
+
+bool ScoreStream::set_score(int player, int hits)
+{
+  if (player < 1 || player > PLAYERS) { return false; }
+  if (scores[player - 1] == hits) { return false; }
+
+  scores[player - 1] = hits;
+
+  publish("data: {\"type\":\"score\",\"player\":%d,\"hits\":%d}\n\n",
+    player, hits);
+
+  return true;
+}
+
+bool ScoreStream::set_current_player(int player, int hits)
+{
+  if (current_player == player && current_hits == hits) { return false; }
+
+  current_player = player;
+  current_hits = hits;
+
+  publish("data: {\"type\":\"player\",\"player\":%d,\"hits\":%d}\n\n",
+    player, hits);
+
+  return true;
+}
+
+int ScoreStream::subscribe()
+{
+  static const char header[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Access-Control-Allow-Origin: *\r\n\r\n";
+
+  for (int i = 0; i < MAX_SUBSCRIBERS; i++)
+  {
+    Subscriber &subscriber = subscribers[i];
+
+    if (subscriber.is_active) { continue; }
+
+    memcpy(subscriber.text, header, sizeof(header) - 1);
+
+    subscriber.is_active  = true;
+    subscriber.is_private = true;
+    subscriber.next       = head;
+    subscriber.offset     = 0;
+    subscriber.length     = sizeof(header) - 1 +
+      render_snapshot(
+        subscriber.text + sizeof(header) - 1,
+        sizeof(subscriber.text) - (sizeof(header) - 1));
+
+    return i;
+  }
+
+  return -1;
+}
+
+void ScoreStream::unsubscribe(int id)
+{
+  subscribers[id].is_active = false;
+}
+
+ScoreStream::Result ScoreStream::get_pending(
+  int id,
+  const uint8_t **data,
+  int *length)
+{
+  Subscriber &subscriber = subscribers[id];
+
+  *length = 0;
+
+  if (! subscriber.is_private)
+  {
+    if (subscriber.next == head) { return STREAM_OK; }
+
+    if (head - subscriber.next > RING_SIZE)
+    {
+      // The update being sent was overwritten, there is no way to
+      // finish it.
+      if (subscriber.offset != 0) { return STREAM_DROPPED; }
+
+      // Too far behind, skip straight to the current scores.
+      subscriber.is_private = true;
+      subscriber.next = head;
+      subscriber.length =
+        render_snapshot(subscriber.text, sizeof(subscriber.text));
+    }
+      else
+    {
+      const Update &update = ring[subscriber.next % RING_SIZE];
+
+      *data = (const uint8_t *)update.text + subscriber.offset;
+      *length = update.length - subscriber.offset;
+
+      return STREAM_OK;
+    }
+  }
+
+  *data = (const uint8_t *)subscriber.text + subscriber.offset;
+  *length = subscriber.length - subscriber.offset;
+
+  return STREAM_OK;
+}
+
+void ScoreStream::consume(int id, int count)
+{
+  Subscriber &subscriber = subscribers[id];
+
+  subscriber.offset += count;
+
+  if (subscriber.is_private)
+  {
+    if (subscriber.offset < subscriber.length) { return; }
+
+    subscriber.is_private = false;
+  }
+    else
+  {
+    if (subscriber.offset < ring[subscriber.next % RING_SIZE].length)
+    {
+      return;
+    }
+
+    subscriber.next++;
+  }
+
+  subscriber.offset = 0;
+}
+
+void ScoreStream::keepalive(int id)
+{
+  Subscriber &subscriber = subscribers[id];
+
+  if (subscriber.is_private || subscriber.next != head) { return; }
+
+  subscriber.is_private = true;
+  subscriber.offset = 0;
+  subscriber.length = snprintf(subscriber.text, sizeof(subscriber.text),
+    ": keepalive\n\n");
+}
+
+void ScoreStream::publish(const char *format, int player, int hits)
+{
+  // The oldest update is overwritten, subscribers still on it notice
+  // the next time they ask for data.
+  Update &update = ring[head % RING_SIZE];
+
+  update.length =
+    snprintf(update.text, sizeof(update.text), format, player, hits);
+
+  head++;
+}
+
+int ScoreStream::render_snapshot(char *text, int length)
+{
+  int n = snprintf(text, length, "data: {\"type\":\"snapshot\",\"scores\":[");
+
+  for (int i = 0; i < PLAYERS; i++)
+  {
+    n += snprintf(text + n, length - n, i == 0 ? "%d" : ",%d", scores[i]);
+  }
+
+  n += snprintf(text + n, length - n, "],\"player\":%d,\"hits\":%d}\n\n",
+    current_player,
+    current_hits);
+
+  return n;
+}
+
@@ -0,0 +1,99 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#ifndef SCORE_STREAM_H
+#define SCORE_STREAM_H
+
+#include <stdint.h>
+
+#include "defines.h"
+
+// Score updates for spectators as a text/event-stream (Server-Sent
+// Events), one JSON object per event. Each change is encoded once into
+// a ring of updates shared by every subscriber, a subscriber is just a
+// position in the ring. Publishing doesn't depend on how many are
+// subscribed.
+//
+// A subscriber that falls more than RING_SIZE updates behind gets one
+// snapshot of the current scores instead of what it missed. One that is
+// stuck part way through an update when it gets overwritten is dropped.
+// Everything runs on the network thread.
+class ScoreStream
+{
+public:
+  ScoreStream();
+  ~ScoreStream();
+
+  enum Result
+  {
+    STREAM_OK,
+    STREAM_DROPPED,
+  };
+
+  // Both return true if the value changed and an update was published.
+  // player is 1 to PLAYERS, or 0 for no current player.
+  bool set_score(int player, int hits);
+  bool set_current_player(int player, int hits);
+
+  // A new subscriber starts with the HTTP header and a snapshot.
+  int subscribe();
+  void unsubscribe(int id);
+
+  // Sets data / length to the next bytes to send to a subscriber,
+  // length is 0 when it's caught up. consume() takes off what was sent.
+  Result get_pending(int id, const uint8_t **data, int *length);
+  void consume(int id, int count);
+
+  // Queues a comment line so an idle connection that went away is
+  // noticed. Only when the subscriber is caught up.
+  void keepalive(int id);
+
+  bool is_active(int id) { return subscribers[id].is_active; }
+
+  static const int PLAYERS = MAX_PLAYERS;
+  static const int MAX_SUBSCRIBERS = 8;
+
+private:
+  struct Update
+  {
+    int length;
+    char text[80];
+  };
+
+  // Anything that isn't one of the shared updates (the header and a
+  // snapshot, or a keepalive) is sent from the subscriber's own buffer.
+  struct Subscriber
+  {
+    bool is_active;
+    bool is_private;
+    uint32_t next;
+    int offset;
+    int length;
+    char text[192 + 6 * PLAYERS];
+  };
+
+  void publish(const char *format, int player, int hits);
+  int render_snapshot(char *text, int length);
+
+  static const int RING_SIZE = 16;
+
+  Update ring[RING_SIZE];
+  Subscriber subscribers[MAX_SUBSCRIBERS];
+  uint32_t head;
+  int scores[PLAYERS];
+  int current_player;
+  int current_hits;
+};
+
+#endif
+
@@ -0,0 +1,114 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#ifndef SCOREBOARD_H
+#define SCOREBOARD_H
+
+#include <string.h>
+
+#include "defines.h"
+#include "Display.h"
+
+// Layout of the scoreboard on the LCD. The fixed text ("Player 1: ",
+// "Current Player:") and the column each number starts at are worked out
+// by the constexpr constructor, so render() only copies the screen and
+// writes the digits into their slots. There's a row for each of the
+// first three players, the last row is the current player.
+class Scoreboard
+{
+public:
+  static const int PLAYERS =
+    MAX_PLAYERS < Display::ROWS - 1 ? MAX_PLAYERS : Display::ROWS - 1;
+
+  constexpr Scoreboard() : text { }, score_column { }, current_column { 0 }
+  {
+    for (int row = 0; row < Display::ROWS; row++)
+    {
+      for (int column = 0; column < Display::COLUMNS; column++)
+      {
+        text[row][column] = ' ';
+      }
+    }
+
+    for (int i = 0; i < PLAYERS; i++)
+    {
+      // Only single digit players fit this way.
+      int column = place(text[i], 0, "Player ");
+      text[i][column++] = '1' + i;
+      score_column[i] = place(text[i], column, ": ");
+    }
+
+    current_column = place(text[PLAYERS], 0, "Current Player:");
+  }
+
+  // current < 0 leaves the last row blank.
+  void render(
+    char screen[Display::ROWS][Display::COLUMNS],
+    const int16_t *hits,
+    int current) const
+  {
+    memcpy(screen, text, sizeof(text));
+
+    for (int i = 0; i < PLAYERS; i++)
+    {
+      write_number(screen[i], score_column[i], hits[i]);
+    }
+
+    if (current >= 0)
+    {
+      write_number(screen[PLAYERS], current_column, current);
+    }
+      else
+    {
+      memset(screen[PLAYERS], ' ', Display::COLUMNS);
+    }
+  }
+
+private:
+  static constexpr int place(char *row, int column, const char *s)
+  {
+    while (*s != 0) { row[column++] = *s++; }
+
+    return column;
+  }
+
+  // Left aligned, the slot is already spaces. Digits that don't fit on
+  // the row are dropped from the front.
+  static void write_number(char *row, int column, int value)
+  {
+    char digits[10];
+    int count = 0;
+
+    if (value < 0) { value = 0; }
+
+    do
+    {
+      digits[count++] = '0' + value % 10;
+      value = value / 10;
+    } while (value != 0);
+
+    if (count > Display::COLUMNS - column)
+    {
+      count = Display::COLUMNS - column;
+    }
+
+    while (count > 0) { row[column++] = digits[--count]; }
+  }
+
+  char text[Display::ROWS][Display::COLUMNS];
+  int score_column[PLAYERS];
+  int current_column;
+};
+
+#endif
+
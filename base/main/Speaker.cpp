@@ -0,0 +1,129 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#include "driver/ledc.h"
+#include "esp_log.h"
+
+#include "Speaker.h"
+
+Speaker::Speaker() :
+  queue      { NULL },
+  task       { NULL },
+  is_playing { false }
+{
+}
+
+Speaker::~Speaker()
+{
+  if (task != NULL) { vTaskDelete(task); }
+}
+
+int Speaker::start(gpio_num_t gpio)
+{
+  // The frequency here is only a starting point, play_note() retunes the
+  // timer for every note.
+  ledc_timer_config_t ledc_timer = { };
+  ledc_timer.speed_mode      = LEDC_LOW_SPEED_MODE;
+  ledc_timer.timer_num       = LEDC_TIMER_0;
+  ledc_timer.duty_resolution = LEDC_TIMER_8_BIT;
+  ledc_timer.freq_hz         = 440;
+  ledc_timer.clk_cfg         = LEDC_AUTO_CLK;
+
+  ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
+
+  ledc_channel_config_t ledc_channel = { };
+  ledc_channel.speed_mode = LEDC_LOW_SPEED_MODE;
+  ledc_channel.channel    = LEDC_CHANNEL_0;
+  ledc_channel.timer_sel  = LEDC_TIMER_0;
+  ledc_channel.intr_type  = LEDC_INTR_DISABLE;
+  ledc_channel.gpio_num   = gpio;
+  ledc_channel.duty       = 0;
+  ledc_channel.hpoint     = 0;
+
+  ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel));
+
+  silence();
+
+  queue = xQueueCreate(QUEUE_SIZE, sizeof(const Note *));
+
+  if (queue == NULL)
+  {
+    ESP_LOGE("speaker", "Can't create queue.");
+    return -1;
+  }
+
+  // Above the game loop so a busy loop doesn't stretch the notes.
+  if (xTaskCreate(audio_task, "audio", 2048, this, 5, &task) != pdPASS)
+  {
+    ESP_LOGE("speaker", "Can't create task.");
+    return -1;
+  }
+
+  return 0;
+}
+
+bool Speaker::play(const Note *song)
+{
+  if (queue == NULL) { return false; }
+
+  return xQueueSend(queue, &song, 0) == pdTRUE;
+}
+
+void Speaker::audio_task(void *context)
+{
+  Speaker *speaker = (Speaker *)context;
+
+  while (true)
+  {
+    const Note *song;
+
+    if (xQueueReceive(speaker->queue, &song, portMAX_DELAY) != pdTRUE)
+    {
+      continue;
+    }
+
+    for (const Note *note = song; note->duration_ms != 0; note++)
+    {
+      speaker->play_note(*note);
+      vTaskDelay(pdMS_TO_TICKS(note->duration_ms));
+    }
+
+    speaker->silence();
+  }
+}
+
+void Speaker::play_note(const Note &note)
+{
+  if (note.frequency == 0)
+  {
+    silence();
+    return;
+  }
+
+  ledc_set_freq(LEDC_LOW_SPEED_MODE, LEDC_TIMER_0, note.frequency);
+
+  // The duty only has to be set again after silence() stopped the output.
+  if (! is_playing)
+  {
+    ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, DUTY_HALF);
+    ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
+    is_playing = true;
+  }
+}
+
+void Speaker::silence()
+{
+  ledc_stop(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, 0);
+  is_playing = false;
+}
+
@@ -0,0 +1,62 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#ifndef SPEAKER_H
+#define SPEAKER_H
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+
+// Plays songs on the speaker from its own task so the game loop never
+// waits on them. A song is a list of notes ending with one that has a
+// duration of 0, play() only queues a pointer to it so songs have to be
+// static. LEDC is set up once, between notes only the frequency changes.
+class Speaker
+{
+public:
+  Speaker();
+  ~Speaker();
+
+  struct Note
+  {
+    // Frequency 0 is a rest.
+    uint16_t frequency;
+    uint16_t duration_ms;
+  };
+
+  int start(gpio_num_t gpio);
+
+  // Returns false if too many songs are already waiting.
+  bool play(const Note *song);
+
+private:
+  static void audio_task(void *context);
+  void play_note(const Note &note);
+  void silence();
+
+  QueueHandle_t queue;
+  TaskHandle_t task;
+  bool is_playing;
+
+  static const int QUEUE_SIZE = 4;
+
+  // 50% duty on the 8 bit timer.
+  static const int DUTY_HALF = 1 << (8 - 1);
+};
+
+#endif
+
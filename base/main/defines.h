@@ -23,5 +23,27 @@
 
 #define GPIO_HOLE    GPIO_NUM_3
 
+// The hole switch has to stay closed this long to count, and a second
+// closure within the lockout is the same ball rattling in the cup. The
+// lockout is kept short since with overlapping play two balls can drop
+// close together, closures it ignores are counted on the status page.
+#define HOLE_GLITCH_US  3000
+#define HOLE_LOCKOUT_MS 250
+
+// Players on this base, each with a ball beacon whose address ends in
+// the player's number. The LCD only has room for the first three, the
+// status page and /events show all of them.
+#define MAX_PLAYERS 3
+
+// Players that can be on the hole at the same time, anyone else who taps
+// in waits in line. A player with no stroke in PLAYER_IDLE_MS gives up
+// their place.
+#define MAX_ACTIVE_PLAYERS 2
+#define PLAYER_IDLE_MS     180000
+
+// Serve the tee control connections with the lwIP netconn API instead of
+// BSD sockets. Frames are then parsed straight out of the received pbufs.
+//#define CONTROL_NETCONN
+
 #endif
 
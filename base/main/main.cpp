@@ -79,7 +79,9 @@ void app_main()
 
   ESP_ERROR_CHECK(nvs_flash_init());
 
-  GolfGameBase golf_game_base;
+  // Static to keep the event queue and the display buffers off the main
+  // task stack.
+  static GolfGameBase golf_game_base;
 
   golf_game_base.run();
 
@@ -0,0 +1,148 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#include <string.h>
+
+#include "ClockSync.h"
+
+ClockSync::ClockSync()
+{
+  reset();
+}
+
+ClockSync::~ClockSync()
+{
+}
+
+void ClockSync::reset()
+{
+  memset(samples, 0, sizeof(samples));
+  memset(&best, 0, sizeof(best));
+  memset(&reference, 0, sizeof(reference));
+
+  count = 0;
+  next = 0;
+  synced = false;
+  drift_known = false;
+  drift_ppb = 0;
+}
+
+void ClockSync::add_sample(int64_t t1, int64_t t2, int64_t t3, int64_t t4)
+{
+  Sample &sample = samples[next];
+
+  sample.local_time = t4;
+  sample.offset = ((t2 - t1) + (t3 - t4)) / 2;
+  sample.delay = (t4 - t1) - (t3 - t2);
+
+  if (sample.delay < 0) { sample.delay = 0; }
+
+  next = (next + 1) % SAMPLES;
+  if (count < SAMPLES) { count++; }
+
+  // Queueing only ever adds delay, so the quickest round trip gives the
+  // most accurate offset.
+  int index = 0;
+
+  for (int i = 1; i < count; i++)
+  {
+    if (samples[i].delay < samples[index].delay) { index = i; }
+  }
+
+  best = samples[index];
+
+  if (! synced)
+  {
+    synced = true;
+    reference = best;
+    return;
+  }
+
+  // Each offset is only good to half its round trip, so wait until the
+  // two samples are far enough apart for that error to be small compared
+  // to the drift being measured.
+  int64_t interval = best.local_time - reference.local_time;
+  int64_t error = (best.delay + reference.delay) / 2;
+
+  if (interval < DRIFT_INTERVAL_US) { return; }
+  if (error * 1000000 / interval > DRIFT_MAX_ERROR_PPM) { return; }
+
+  // No crystal is this far off, the other end's clock jumped (it
+  // rebooted or the samples are bad). Measure again from here. This also
+  // keeps the multiply below from overflowing.
+  int64_t change = best.offset - reference.offset;
+  int64_t change_max = interval * DRIFT_MAX_PPM / 1000000;
+
+  if (change > change_max || change < -change_max)
+  {
+    reference = best;
+    return;
+  }
+
+  int32_t measured = (int32_t)(change * 1000000000 / interval);
+
+  // Smooth out the jitter of single measurements.
+  drift_ppb = drift_known ? (drift_ppb * 3 + measured) / 4 : measured;
+  drift_known = true;
+  reference = best;
+}
+
+void ClockSync::set_estimate(
+  int64_t local_time,
+  int64_t offset,
+  int64_t uncertainty,
+  int32_t drift_ppb)
+{
+  best.local_time = local_time;
+  best.offset = offset;
+  best.delay = uncertainty * 2;
+
+  this->drift_ppb = drift_ppb;
+
+  synced = true;
+  drift_known = drift_ppb != 0;
+}
+
+int64_t ClockSync::get_offset(int64_t local_time)
+{
+  if (! synced) { return 0; }
+
+  return best.offset +
+    (local_time - best.local_time) * drift_ppb / 1000000000;
+}
+
+int64_t ClockSync::to_local(int64_t remote_time)
+{
+  if (! synced) { return remote_time; }
+
+  // remote = local + offset + (local - best) * drift, solved for local.
+  int64_t elapsed = remote_time - best.offset - best.local_time;
+
+  // Written so elapsed is only ever multiplied by the drift, like in
+  // get_offset(), instead of by 10^9.
+  return best.local_time + elapsed -
+    elapsed * drift_ppb / (1000000000 + drift_ppb);
+}
+
+int64_t ClockSync::get_uncertainty(int64_t local_time)
+{
+  if (! synced) { return -1; }
+
+  int64_t age = local_time - best.local_time;
+  if (age < 0) { age = -age; }
+
+  const int error_ppm = drift_known ? ERROR_PPM_KNOWN : ERROR_PPM_UNKNOWN;
+
+  return best.delay / 2 + age * error_ppm / 1000000;
+}
+
@@ -0,0 +1,96 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <stdint.h>
+
+// Estimates the offset between the local esp_timer clock and a remote
+// one, NTP style. Each round trip gives four times:
+//
+//   t1: local send     t2: remote receive
+//   t3: remote send    t4: local receive
+//
+// offset = ((t2 - t1) + (t3 - t4)) / 2 and the true offset is within
+// half the round trip delay of that. Of the last SAMPLES round trips the
+// one with the smallest delay is used, and the drift between the two
+// crystals is measured from how that offset moves over at least
+// DRIFT_INTERVAL_US (longer if the delays are too large to measure it to
+// DRIFT_MAX_ERROR_PPM). All times are microseconds, offsets are remote minus
+// local. Not thread safe, the owner has to hold its own lock.
+class ClockSync
+{
+public:
+  ClockSync();
+  ~ClockSync();
+
+  void reset();
+
+  void add_sample(int64_t t1, int64_t t2, int64_t t3, int64_t t4);
+
+  // Takes an estimate made by the other end instead of measuring one.
+  void set_estimate(
+    int64_t local_time,
+    int64_t offset,
+    int64_t uncertainty,
+    int32_t drift_ppb);
+
+  bool is_synced() { return synced; }
+  int32_t get_drift() { return drift_ppb; }
+
+  int64_t get_offset(int64_t local_time);
+  int64_t get_uncertainty(int64_t local_time);
+
+  int64_t to_remote(int64_t local_time)
+  {
+    return local_time + get_offset(local_time);
+  }
+
+  // The other way around, for when the estimate is kept in the other
+  // end's time but the question is asked in this one's.
+  int64_t to_local(int64_t remote_time);
+
+private:
+  struct Sample
+  {
+    int64_t local_time;
+    int64_t offset;
+    int64_t delay;
+  };
+
+  static const int SAMPLES = 8;
+  static const int64_t DRIFT_INTERVAL_US = 30000000;
+  static const int DRIFT_MAX_ERROR_PPM = 5;
+
+  // Anything more than this is a clock that jumped, not drift.
+  static const int DRIFT_MAX_PPM = 1000;
+
+  // How fast the error grows between samples, the spec of two 20 ppm
+  // crystals until the drift has been measured.
+  static const int ERROR_PPM_UNKNOWN = 40;
+  static const int ERROR_PPM_KNOWN = 5;
+
+  Sample samples[SAMPLES];
+  int count;
+  int next;
+
+  Sample best;
+  Sample reference;
+  bool synced;
+  bool drift_known;
+  int32_t drift_ppb;
+};
+
+#endif
+
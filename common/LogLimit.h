@@ -0,0 +1,71 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#ifndef LOG_LIMIT_H
+#define LOG_LIMIT_H
+
+#include <stdint.h>
+
+#include "esp_timer.h"
+
+// Rate limit for log lines on hot paths. allow() lets through at most
+// "limit" lines per second and counts the rest, so the next line that
+// gets through can report how many were skipped.
+class LogLimit
+{
+public:
+  LogLimit(int limit) :
+    limit        { limit },
+    count        { 0 },
+    suppressed   { 0 },
+    window_start { 0 }
+  {
+  }
+
+  bool allow()
+  {
+    int64_t now = esp_timer_get_time();
+
+    if (now - window_start >= 1000000)
+    {
+      window_start = now;
+      count = 0;
+    }
+
+    if (count >= limit)
+    {
+      suppressed++;
+      return false;
+    }
+
+    count++;
+
+    return true;
+  }
+
+  int take_suppressed()
+  {
+    int value = suppressed;
+    suppressed = 0;
+    return value;
+  }
+
+private:
+  int limit;
+  int count;
+  int suppressed;
+  int64_t window_start;
+};
+
+#endif
+
@@ -16,6 +16,10 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "esp_timer.h"
+#include "esp_vfs_eventfd.h"
 
 #include "Network.h"
 
@@ -27,75 +31,210 @@ Network::~Network()
 {
 }
 
-int Network::net_send(int socket_id, const uint8_t *buffer, int length)
+Network::Cancel::Cancel() : event_id { -1 }
+{
+}
+
+Network::Cancel::~Cancel()
+{
+  if (event_id != -1) { close(event_id); }
+}
+
+int Network::Cancel::open()
+{
+  event_id = open_eventfd();
+
+  return event_id < 0 ? -1 : 0;
+}
+
+void Network::Cancel::cancel()
+{
+  uint64_t value = 1;
+
+  if (event_id != -1) { write(event_id, &value, sizeof(value)); }
+}
+
+void Network::Cancel::reset()
+{
+  if (event_id == -1) { return; }
+
+  // Only read when set, so this never blocks.
+  struct timeval tv = { };
+  fd_set readset;
+
+  FD_ZERO(&readset);
+  FD_SET(event_id, &readset);
+
+  if (select(event_id + 1, &readset, NULL, NULL, &tv) == 1)
+  {
+    uint64_t value;
+    read(event_id, &value, sizeof(value));
+  }
+}
+
+int Network::open_eventfd()
+{
+  // Registering a second time just fails with ESP_ERR_INVALID_STATE.
+  esp_vfs_eventfd_config_t config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+  config.max_fds = EVENTFD_MAX;
+  esp_vfs_eventfd_register(&config);
+
+  return eventfd(0, 0);
+}
+
+const char *Network::get_status_name(Status status)
+{
+  switch (status)
+  {
+    case NET_OK:        return "ok";
+    case NET_TIMEOUT:   return "timeout";
+    case NET_CLOSED:    return "closed";
+    case NET_ERROR:     return "error";
+    case NET_CANCELLED: return "cancelled";
+  }
+
+  return "?";
+}
+
+Network::Status Network::net_send_until(
+  int socket_id,
+  const uint8_t *buffer,
+  int length,
+  int64_t deadline,
+  int *count,
+  Cancel *cancel)
 {
-  struct timeval tv;
-  fd_set writeset;
-    
   int bytes_sent = 0;
 
+  *count = 0;
+
   while (bytes_sent < length)
   {
-    FD_ZERO(&writeset);
-    FD_SET(socket_id, &writeset);
-
-    tv.tv_sec = 10;
-    tv.tv_usec = 0;
+    // Try first, only wait if the socket's send buffer is full.
+    int n = send(
+      socket_id,
+      buffer + bytes_sent,
+      length - bytes_sent,
+      MSG_DONTWAIT);
 
-    int n = select(socket_id + 1, NULL, &writeset, NULL, &tv);
+    if (n > 0)
+    {
+      bytes_sent += n;
+      *count = bytes_sent;
+      continue;
+    }
 
-    if (n == -1)
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
     {
-      if (errno == EINTR) { continue; }
+      if (errno == EPIPE || errno == ECONNRESET || errno == ENOTCONN)
+      {
+        return NET_CLOSED;
+      }
 
-      perror("Problem with select in net_send");
-      return -1;
+      return NET_ERROR;
     }
 
-    if (n == 0) { return -3; }
-
-    n = send(socket_id, buffer + bytes_sent, length - bytes_sent, 0);
-    if (n < 0) { return -4; }
+    Status status = net_wait(socket_id, true, deadline, cancel);
 
-    bytes_sent += n;
+    if (status != NET_OK) { return status; }
   }
 
-  return bytes_sent;
+  return NET_OK;
 }
 
-int Network::net_recv(int socket_id, uint8_t *buffer, int length)
+Network::Status Network::net_recv_until(
+  int socket_id,
+  uint8_t *buffer,
+  int length,
+  int64_t deadline,
+  int *count,
+  Cancel *cancel)
 {
-  struct timeval tv;
-  fd_set readset;
-  int count = 0;
+  *count = 0;
 
-  while (count < 5)
+  while (true)
   {
-    FD_ZERO(&readset);
-    FD_SET(socket_id, &readset);
+    // Like recv(), returns as soon as there is some data.
+    int n = recv(socket_id, buffer, length, MSG_DONTWAIT);
 
-    tv.tv_sec = 2;
-    tv.tv_usec = 0;
-    count++;
-
-    int n = select(socket_id + 1, &readset, NULL, NULL, &tv);
-
-    if (n == -1)
+    if (n > 0)
     {
-      if (errno == EINTR) { continue; }
-      return -1;
+      *count = n;
+      return NET_OK;
     }
 
-    // Timeout on select().
-    if (n == 0) { continue; }
+    if (n == 0) { return NET_CLOSED; }
 
-    if (FD_ISSET(socket_id, &readset))
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
     {
-      return recv(socket_id, buffer, length, 0);
+      if (errno == ECONNRESET || errno == ENOTCONN) { return NET_CLOSED; }
+
+      return NET_ERROR;
     }
+
+    Status status = net_wait(socket_id, false, deadline, cancel);
+
+    if (status != NET_OK) { return status; }
   }
+}
 
-  return -5;
+int64_t Network::get_deadline(int timeout_ms)
+{
+  return esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+}
+
+int64_t Network::get_dead_time(int64_t last_heard)
+{
+  return last_heard + (int64_t)HEARTBEAT_INTERVAL_MS * HEARTBEAT_MISSES * 1000;
+}
+
+void Network::set_keepalive(int socket_id)
+{
+  // The default keepalive waits two hours before the first probe.
+  int value = 1;
+  setsockopt(socket_id, SOL_SOCKET, SO_KEEPALIVE, &value, sizeof(value));
+
+  value = KEEPALIVE_IDLE;
+  setsockopt(socket_id, IPPROTO_TCP, TCP_KEEPIDLE, &value, sizeof(value));
+
+  value = KEEPALIVE_INTERVAL;
+  setsockopt(socket_id, IPPROTO_TCP, TCP_KEEPINTVL, &value, sizeof(value));
+
+  value = KEEPALIVE_COUNT;
+  setsockopt(socket_id, IPPROTO_TCP, TCP_KEEPCNT, &value, sizeof(value));
+}
+
+int Network::net_send(int socket_id, const uint8_t *buffer, int length)
+{
+  // Older interface, the whole send now shares one 10 second budget
+  // instead of 10 seconds per partial write.
+  int count;
+
+  Status status =
+    net_send_until(socket_id, buffer, length, get_deadline(10000), &count);
+
+  switch (status)
+  {
+    case NET_OK:      return count;
+    case NET_TIMEOUT: return -3;
+    default:          return -4;
+  }
+}
+
+int Network::net_recv(int socket_id, uint8_t *buffer, int length)
+{
+  int count;
+
+  Status status =
+    net_recv_until(socket_id, buffer, length, get_deadline(10000), &count);
+
+  switch (status)
+  {
+    case NET_OK:      return count;
+    case NET_CLOSED:  return 0;
+    case NET_TIMEOUT: return -5;
+    default:          return -1;
+  }
 }
 
 void Network::net_close(int socket_id)
@@ -107,3 +246,62 @@ void Network::net_close(int socket_id)
   }
 }
 
+Network::Status Network::net_wait(
+  int socket_id,
+  bool is_write,
+  int64_t deadline,
+  Cancel *cancel)
+{
+  struct timeval tv;
+  fd_set readset;
+  fd_set writeset;
+
+  while (true)
+  {
+    int64_t remaining = deadline - esp_timer_get_time();
+
+    if (remaining <= 0) { return NET_TIMEOUT; }
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    if (is_write)
+    {
+      FD_SET(socket_id, &writeset);
+    }
+      else
+    {
+      FD_SET(socket_id, &readset);
+    }
+
+    int max_id = socket_id;
+
+    if (cancel != NULL && cancel->get_id() != -1)
+    {
+      FD_SET(cancel->get_id(), &readset);
+      if (cancel->get_id() > max_id) { max_id = cancel->get_id(); }
+    }
+
+    tv.tv_sec  = remaining / 1000000;
+    tv.tv_usec = remaining % 1000000;
+
+    int n = select(max_id + 1, &readset, &writeset, NULL, &tv);
+
+    if (n == -1)
+    {
+      if (errno == EINTR) { continue; }
+      return NET_ERROR;
+    }
+
+    if (n == 0) { return NET_TIMEOUT; }
+
+    if (cancel != NULL && cancel->get_id() != -1 &&
+        FD_ISSET(cancel->get_id(), &readset))
+    {
+      return NET_CANCELLED;
+    }
+
+    return NET_OK;
+  }
+}
+
@@ -22,8 +22,32 @@
 #define SSID "minigolf"
 #define PASSWORD "minigolf"
 #define CHANNEL 6
-//#define HTTP_PORT 80
+#define HTTP_PORT 80
+#define BASE_ADDRESS "192.168.4.1"
 #define CONTROL_PORT 8000
+#define CONTROL_UDP_PORT 8001
+
+// The tee sends a heartbeat every HEARTBEAT_INTERVAL_MS on the control
+// connection and the base answers each one. Either side drops the
+// connection after HEARTBEAT_MISSES intervals without hearing anything.
+#ifndef HEARTBEAT_INTERVAL_MS
+#define HEARTBEAT_INTERVAL_MS 500
+#endif
+#ifndef HEARTBEAT_MISSES
+#define HEARTBEAT_MISSES 3
+#endif
+
+// Eventfds for the whole program. The VFS driver is registered once with
+// room for this many: the Reactor's wake up, Cancel, and on the base with
+// CONTROL_NETCONN the listener, the rejecter and one per connection.
+#ifndef EVENTFD_MAX
+#define EVENTFD_MAX 16
+#endif
+
+// TCP keepalive (in seconds) backs up the heartbeat.
+#define KEEPALIVE_IDLE 2
+#define KEEPALIVE_INTERVAL 1
+#define KEEPALIVE_COUNT 3
 
 class Network
 {
@@ -31,10 +55,72 @@ public:
   Network();
   ~Network();
 
+  enum Status
+  {
+    NET_OK,
+    NET_TIMEOUT,
+    NET_CLOSED,
+    NET_ERROR,
+    NET_CANCELLED,
+  };
+
+  // Lets another task (or the Wi-Fi event handler) break a send or
+  // receive that is waiting on its deadline.
+  class Cancel
+  {
+  public:
+    Cancel();
+    ~Cancel();
+
+    int open();
+    void cancel();
+    void reset();
+    int get_id() { return event_id; }
+
+  private:
+    int event_id;
+  };
+
+  static const char *get_status_name(Status status);
+
+  // Every eventfd is made through here so the VFS driver is always
+  // registered with EVENTFD_MAX, no matter who asks first.
+  static int open_eventfd();
+
 protected:
+  // Deadlines are absolute esp_timer_get_time() values. A deadline in
+  // the past makes the call non-blocking. count is set to the number of
+  // bytes moved even when the result isn't NET_OK.
+  static Status net_send_until(
+    int socket_id,
+    const uint8_t *buffer,
+    int length,
+    int64_t deadline,
+    int *count,
+    Cancel *cancel = NULL);
+
+  static Status net_recv_until(
+    int socket_id,
+    uint8_t *buffer,
+    int length,
+    int64_t deadline,
+    int *count,
+    Cancel *cancel = NULL);
+
+  static int64_t get_deadline(int timeout_ms);
+  static int64_t get_dead_time(int64_t last_heard);
+  static void set_keepalive(int socket_id);
+
   static int net_send(int socket_id, const uint8_t *buffer, int length);
   static int net_recv(int socket_id, uint8_t *buffer, int length);
   static void net_close(int socket_id);
+
+private:
+  static Status net_wait(
+    int socket_id,
+    bool is_write,
+    int64_t deadline,
+    Cancel *cancel);
 };
 
 #endif
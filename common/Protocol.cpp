@@ -0,0 +1,250 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#include <string.h>
+
+#include "Protocol.h"
+
+int Protocol::encode(
+  uint8_t *buffer,
+  int length,
+  int type,
+  uint16_t sequence,
+  int64_t timestamp,
+  const uint8_t *payload,
+  int payload_length)
+{
+  if (payload_length < 0 || payload_length > MAX_PAYLOAD) { return -1; }
+
+  const int frame_length = HEADER_SIZE + payload_length;
+
+  if (frame_length > length) { return -1; }
+
+  buffer[0] = frame_length - 1;
+  buffer[1] = PROTOCOL_VERSION;
+  buffer[2] = type;
+  put_uint16(buffer + 3, sequence);
+  put_uint64(buffer + 5, (uint64_t)timestamp);
+
+  if (payload_length != 0)
+  {
+    memcpy(buffer + HEADER_SIZE, payload, payload_length);
+  }
+
+  return frame_length;
+}
+
+int Protocol::encode_start_player(
+  uint8_t *buffer,
+  int length,
+  uint16_t sequence,
+  int64_t timestamp,
+  int player)
+{
+  uint8_t payload[1];
+
+  payload[0] = player;
+
+  return encode(
+    buffer,
+    length,
+    MSG_START_PLAYER,
+    sequence,
+    timestamp,
+    payload,
+    sizeof(payload));
+}
+
+int Protocol::encode_ack(
+  uint8_t *buffer,
+  int length,
+  uint16_t sequence,
+  int64_t timestamp,
+  uint16_t acked)
+{
+  uint8_t payload[2];
+
+  put_uint16(payload, acked);
+
+  return encode(
+    buffer,
+    length,
+    MSG_ACK,
+    sequence,
+    timestamp,
+    payload,
+    sizeof(payload));
+}
+
+int Protocol::encode_sack(
+  uint8_t *buffer,
+  int length,
+  uint16_t sequence,
+  int64_t timestamp,
+  uint16_t highest,
+  uint32_t mask)
+{
+  uint8_t payload[6];
+
+  put_uint16(payload, highest);
+  put_uint32(payload + 2, mask);
+
+  return encode(
+    buffer,
+    length,
+    MSG_SACK,
+    sequence,
+    timestamp,
+    payload,
+    sizeof(payload));
+}
+
+int Protocol::encode_heartbeat(
+  uint8_t *buffer,
+  int length,
+  uint16_t sequence,
+  int64_t timestamp,
+  int64_t offset,
+  uint32_t uncertainty,
+  int32_t drift_ppb)
+{
+  uint8_t payload[16];
+
+  put_uint64(payload, (uint64_t)offset);
+  put_uint32(payload + 8, uncertainty);
+  put_uint32(payload + 12, (uint32_t)drift_ppb);
+
+  return encode(
+    buffer,
+    length,
+    MSG_HEARTBEAT,
+    sequence,
+    timestamp,
+    payload,
+    sizeof(payload));
+}
+
+int Protocol::encode_heartbeat_reply(
+  uint8_t *buffer,
+  int length,
+  uint16_t sequence,
+  int64_t timestamp,
+  int64_t t1,
+  int64_t t2)
+{
+  uint8_t payload[16];
+
+  put_uint64(payload, (uint64_t)t1);
+  put_uint64(payload + 8, (uint64_t)t2);
+
+  return encode(
+    buffer,
+    length,
+    MSG_HEARTBEAT_REPLY,
+    sequence,
+    timestamp,
+    payload,
+    sizeof(payload));
+}
+
+int Protocol::decode(const uint8_t *buffer, int length, Message &message)
+{
+  // Returns the number of bytes used by the frame, 0 if the frame isn't
+  // complete yet, or -1 if the data can't be a valid frame.
+  if (length < 1) { return 0; }
+
+  const int frame_length = buffer[0] + 1;
+
+  if (frame_length < HEADER_SIZE || frame_length > MAX_FRAME) { return -1; }
+  if (length < 2) { return 0; }
+  if (buffer[1] != PROTOCOL_VERSION) { return -1; }
+  if (length < frame_length) { return 0; }
+
+  message.version        = buffer[1];
+  message.type           = buffer[2];
+  message.sequence       = get_uint16(buffer + 3);
+  message.timestamp      = (int64_t)get_uint64(buffer + 5);
+  message.payload        = buffer + HEADER_SIZE;
+  message.payload_length = frame_length - HEADER_SIZE;
+
+  return frame_length;
+}
+
+int Protocol::decode_start_player(const Message &message, int &player)
+{
+  if (message.type != MSG_START_PLAYER || message.payload_length < 1)
+  {
+    return -1;
+  }
+
+  player = message.payload[0];
+
+  return 0;
+}
+
+int Protocol::decode_ack(const Message &message, uint16_t &acked)
+{
+  if (message.type != MSG_ACK || message.payload_length < 2) { return -1; }
+
+  acked = get_uint16(message.payload);
+
+  return 0;
+}
+
+int Protocol::decode_heartbeat(
+  const Message &message,
+  int64_t &offset,
+  uint32_t &uncertainty,
+  int32_t &drift_ppb)
+{
+  if (message.type != MSG_HEARTBEAT || message.payload_length < 16)
+  {
+    return -1;
+  }
+
+  offset      = (int64_t)get_uint64(message.payload);
+  uncertainty = get_uint32(message.payload + 8);
+  drift_ppb   = (int32_t)get_uint32(message.payload + 12);
+
+  return 0;
+}
+
+int Protocol::decode_heartbeat_reply(
+  const Message &message,
+  int64_t &t1,
+  int64_t &t2)
+{
+  if (message.type != MSG_HEARTBEAT_REPLY || message.payload_length < 16)
+  {
+    return -1;
+  }
+
+  t1 = (int64_t)get_uint64(message.payload);
+  t2 = (int64_t)get_uint64(message.payload + 8);
+
+  return 0;
+}
+
+int Protocol::decode_sack(
+  const Message &message,
+  uint16_t &highest,
+  uint32_t &mask)
+{
+  if (message.type != MSG_SACK || message.payload_length < 6) { return -1; }
+
+  highest = get_uint16(message.payload);
+  mask    = get_uint32(message.payload + 2);
+
+  return 0;
+}
+
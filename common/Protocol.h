@@ -0,0 +1,200 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+// Control channel framing between the tee and the base. Every message is
+// a frame (all fields little endian):
+//
+//   0: length     Number of bytes after this field (header + payload).
+//   1: version    PROTOCOL_VERSION.
+//   2: type       MSG_*.
+//   3: sequence   uint16_t, per sender.
+//   5: timestamp  int64_t, esp_timer microseconds of the sender.
+//  13: payload    0 to MAX_PAYLOAD bytes.
+//
+// Several frames can be written back to back into one buffer so a batch
+// of events goes out as a single TCP segment. Both encode and decode work
+// directly on the caller's buffer and never allocate.
+
+#define PROTOCOL_VERSION 1
+
+class Protocol
+{
+public:
+  enum
+  {
+    MSG_START_PLAYER    = 1,
+    MSG_ACK             = 2,
+    MSG_SACK            = 3,
+    MSG_HEARTBEAT       = 4,
+    MSG_HEARTBEAT_REPLY = 5,
+  };
+
+  struct Message
+  {
+    uint8_t version;
+    uint8_t type;
+    uint16_t sequence;
+    int64_t timestamp;
+    const uint8_t *payload;
+    int payload_length;
+  };
+
+  static const int HEADER_SIZE = 13;
+  static const int MAX_PAYLOAD = 32;
+  static const int MAX_FRAME   = HEADER_SIZE + MAX_PAYLOAD;
+
+  static const int START_PLAYER_SIZE    = HEADER_SIZE + 1;
+  static const int ACK_SIZE             = HEADER_SIZE + 2;
+  static const int SACK_SIZE            = HEADER_SIZE + 6;
+  static const int HEARTBEAT_SIZE       = HEADER_SIZE + 16;
+  static const int HEARTBEAT_REPLY_SIZE = HEADER_SIZE + 16;
+
+  // Sent in a heartbeat by a tee whose clock isn't synced yet.
+  static const uint32_t UNCERTAINTY_UNKNOWN = 0xffffffff;
+
+  static int encode(
+    uint8_t *buffer,
+    int length,
+    int type,
+    uint16_t sequence,
+    int64_t timestamp,
+    const uint8_t *payload,
+    int payload_length);
+
+  static int encode_start_player(
+    uint8_t *buffer,
+    int length,
+    uint16_t sequence,
+    int64_t timestamp,
+    int player);
+
+  static int encode_ack(
+    uint8_t *buffer,
+    int length,
+    uint16_t sequence,
+    int64_t timestamp,
+    uint16_t acked);
+
+  // Selective ack (used on UDP): highest is the newest sequence seen and
+  // bit n of mask is set if sequence highest - 1 - n was also seen.
+  static int encode_sack(
+    uint8_t *buffer,
+    int length,
+    uint16_t sequence,
+    int64_t timestamp,
+    uint16_t highest,
+    uint32_t mask);
+
+  // The tee's heartbeat carries its current estimate of the base's clock
+  // (offset and uncertainty in microseconds at timestamp, drift in parts
+  // per billion) so the base can map event timestamps into its own time.
+  static int encode_heartbeat(
+    uint8_t *buffer,
+    int length,
+    uint16_t sequence,
+    int64_t timestamp,
+    int64_t offset,
+    uint32_t uncertainty,
+    int32_t drift_ppb);
+
+  // The reply echoes the heartbeat's timestamp (t1) along with the time
+  // the base received it (t2). Its own timestamp is the send time (t3).
+  static int encode_heartbeat_reply(
+    uint8_t *buffer,
+    int length,
+    uint16_t sequence,
+    int64_t timestamp,
+    int64_t t1,
+    int64_t t2);
+
+  static int decode(const uint8_t *buffer, int length, Message &message);
+  static int decode_start_player(const Message &message, int &player);
+  static int decode_ack(const Message &message, uint16_t &acked);
+
+  static int decode_heartbeat(
+    const Message &message,
+    int64_t &offset,
+    uint32_t &uncertainty,
+    int32_t &drift_ppb);
+
+  static int decode_heartbeat_reply(
+    const Message &message,
+    int64_t &t1,
+    int64_t &t2);
+
+  static int decode_sack(
+    const Message &message,
+    uint16_t &highest,
+    uint32_t &mask);
+
+  static bool is_in_sack(uint16_t sequence, uint16_t highest, uint32_t mask)
+  {
+    if (sequence == highest) { return true; }
+    if (is_after(sequence, highest)) { return false; }
+
+    int n = (uint16_t)(highest - sequence) - 1;
+
+    return n < 32 && (mask & (1u << n)) != 0;
+  }
+
+  // True if sequence a comes after b, allowing for wrap around.
+  static bool is_after(uint16_t a, uint16_t b)
+  {
+    return (int16_t)(a - b) > 0;
+  }
+
+  static uint16_t get_uint16(const uint8_t *data)
+  {
+    return data[0] | (data[1] << 8);
+  }
+
+  static uint32_t get_uint32(const uint8_t *data)
+  {
+    return get_uint16(data) | ((uint32_t)get_uint16(data + 2) << 16);
+  }
+
+  static uint64_t get_uint64(const uint8_t *data)
+  {
+    return get_uint32(data) | ((uint64_t)get_uint32(data + 4) << 32);
+  }
+
+  static void put_uint16(uint8_t *data, uint16_t value)
+  {
+    data[0] = value & 0xff;
+    data[1] = value >> 8;
+  }
+
+  static void put_uint32(uint8_t *data, uint32_t value)
+  {
+    put_uint16(data, value & 0xffff);
+    put_uint16(data + 2, value >> 16);
+  }
+
+  static void put_uint64(uint8_t *data, uint64_t value)
+  {
+    put_uint32(data, value & 0xffffffff);
+    put_uint32(data + 4, value >> 32);
+  }
+
+private:
+  Protocol();
+  ~Protocol();
+};
+
+#endif
+
@@ -0,0 +1,356 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/select.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "Network.h"
+#include "Reactor.h"
+
+Reactor::Reactor(int max_handlers, int max_timers) :
+  handlers      { NULL },
+  timers        { NULL },
+  max_handlers  { max_handlers },
+  max_timers    { max_timers },
+  max_id        { -1 },
+  wake_id       { -1 },
+  wake_callback { NULL },
+  wake_context  { NULL }
+{
+  handlers = (Handler *)malloc(sizeof(Handler) * max_handlers);
+  timers = (Timer *)malloc(sizeof(Timer) * max_timers);
+
+  if (handlers == NULL || timers == NULL)
+  {
+    ESP_LOGE("reactor", "Can't allocate %d handlers and %d timers.",
+      max_handlers, max_timers);
+
+    this->max_handlers = handlers == NULL ? 0 : max_handlers;
+    this->max_timers = timers == NULL ? 0 : max_timers;
+  }
+
+  for (int i = 0; i < this->max_handlers; i++)
+  {
+    handlers[i].socket_id = -1;
+    handlers[i].events    = 0;
+    handlers[i].callback  = NULL;
+    handlers[i].context   = NULL;
+  }
+
+  for (int i = 0; i < this->max_timers; i++)
+  {
+    timers[i].deadline = 0;
+    timers[i].period   = 0;
+    timers[i].callback = NULL;
+    timers[i].context  = NULL;
+  }
+
+  FD_ZERO(&readset);
+  FD_ZERO(&writeset);
+}
+
+Reactor::~Reactor()
+{
+  if (wake_id != -1) { close(wake_id); }
+
+  free(handlers);
+  free(timers);
+}
+
+int Reactor::open(TimerCallback wake_callback, void *context)
+{
+  // The eventfd lets other tasks (and the Wi-Fi event handler) break the
+  // loop out of select().
+  wake_id = Network::open_eventfd();
+
+  if (wake_id < 0)
+  {
+    ESP_LOGE("reactor", "Can't create eventfd.");
+    return -1;
+  }
+
+  this->wake_callback = wake_callback;
+  this->wake_context  = context;
+
+  FD_SET(wake_id, &readset);
+  update_max();
+
+  return 0;
+}
+
+int Reactor::add(
+  int socket_id,
+  int events,
+  SocketCallback callback,
+  void *context)
+{
+  int index = find(socket_id);
+
+  if (index == -1) { index = find(-1); }
+
+  if (index == -1)
+  {
+    ESP_LOGE("reactor", "No room for socket_id=%d.", socket_id);
+    return -1;
+  }
+
+  Handler &handler = handlers[index];
+
+  handler.socket_id = socket_id;
+  handler.callback  = callback;
+  handler.context   = context;
+
+  return modify(socket_id, events);
+}
+
+int Reactor::modify(int socket_id, int events)
+{
+  int index = find(socket_id);
+
+  if (index == -1) { return -1; }
+
+  handlers[index].events = events;
+
+  if ((events & EVENT_READ) != 0)
+  {
+    FD_SET(socket_id, &readset);
+  }
+    else
+  {
+    FD_CLR(socket_id, &readset);
+  }
+
+  if ((events & EVENT_WRITE) != 0)
+  {
+    FD_SET(socket_id, &writeset);
+  }
+    else
+  {
+    FD_CLR(socket_id, &writeset);
+  }
+
+  update_max();
+
+  return 0;
+}
+
+void Reactor::remove(int socket_id)
+{
+  int index = find(socket_id);
+
+  if (index == -1) { return; }
+
+  FD_CLR(socket_id, &readset);
+  FD_CLR(socket_id, &writeset);
+
+  handlers[index].socket_id = -1;
+  handlers[index].events    = 0;
+  handlers[index].callback  = NULL;
+  handlers[index].context   = NULL;
+
+  update_max();
+}
+
+int Reactor::timer_start(
+  int delay_ms,
+  int period_ms,
+  TimerCallback callback,
+  void *context)
+{
+  for (int i = 0; i < max_timers; i++)
+  {
+    Timer &timer = timers[i];
+
+    if (timer.callback != NULL) { continue; }
+
+    timer.deadline = esp_timer_get_time() + (int64_t)delay_ms * 1000;
+    timer.period   = (int64_t)period_ms * 1000;
+    timer.callback = callback;
+    timer.context  = context;
+
+    return i;
+  }
+
+  ESP_LOGE("reactor", "No free timers.");
+
+  return -1;
+}
+
+void Reactor::timer_stop(int id)
+{
+  if (id < 0 || id >= max_timers) { return; }
+
+  timers[id].callback = NULL;
+  timers[id].context  = NULL;
+}
+
+void Reactor::wake()
+{
+  uint64_t value = 1;
+
+  if (wake_id != -1) { write(wake_id, &value, sizeof(value)); }
+}
+
+void Reactor::run_once(int max_wait_ms)
+{
+  // select() changes the sets passed to it, so it works on a copy.
+  fd_set read_ready = readset;
+  fd_set write_ready = writeset;
+  struct timeval tv;
+  struct timeval *timeout = NULL;
+
+  int timeout_ms = get_timeout_ms(max_wait_ms);
+
+  if (timeout_ms >= 0)
+  {
+    tv.tv_sec  = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    timeout = &tv;
+  }
+
+  int n = select(max_id + 1, &read_ready, &write_ready, NULL, timeout);
+
+  if (n == -1)
+  {
+    if (errno != EINTR)
+    {
+      ESP_LOGE("reactor", "select() failed errno=%d", errno);
+      usleep(10000);
+    }
+
+    return;
+  }
+
+  if (n > 0)
+  {
+    if (wake_id != -1 && FD_ISSET(wake_id, &read_ready))
+    {
+      uint64_t value;
+
+      read(wake_id, &value, sizeof(value));
+
+      if (wake_callback != NULL) { wake_callback(wake_context); }
+    }
+
+    for (int i = 0; i < max_handlers; i++)
+    {
+      // Copy the handler since the callback may remove it.
+      Handler handler = handlers[i];
+
+      if (handler.socket_id == -1) { continue; }
+
+      int events = 0;
+
+      if ((handler.events & EVENT_READ) != 0 &&
+          FD_ISSET(handler.socket_id, &read_ready))
+      {
+        events |= EVENT_READ;
+      }
+
+      if ((handler.events & EVENT_WRITE) != 0 &&
+          FD_ISSET(handler.socket_id, &write_ready))
+      {
+        events |= EVENT_WRITE;
+      }
+
+      if (events != 0)
+      {
+        handler.callback(handler.context, handler.socket_id, events);
+      }
+    }
+  }
+
+  run_timers();
+}
+
+void Reactor::run()
+{
+  while (true)
+  {
+    run_once();
+  }
+}
+
+int Reactor::find(int socket_id)
+{
+  for (int i = 0; i < max_handlers; i++)
+  {
+    if (handlers[i].socket_id == socket_id) { return i; }
+  }
+
+  return -1;
+}
+
+void Reactor::update_max()
+{
+  max_id = wake_id;
+
+  for (int i = 0; i < max_handlers; i++)
+  {
+    if (handlers[i].socket_id > max_id) { max_id = handlers[i].socket_id; }
+  }
+}
+
+int Reactor::get_timeout_ms(int max_wait_ms)
+{
+  int64_t now = esp_timer_get_time();
+  int timeout_ms = max_wait_ms;
+
+  for (int i = 0; i < max_timers; i++)
+  {
+    if (timers[i].callback == NULL) { continue; }
+
+    int64_t wait = timers[i].deadline - now;
+    int wait_ms = wait <= 0 ? 0 : (int)((wait + 999) / 1000);
+
+    if (timeout_ms < 0 || wait_ms < timeout_ms) { timeout_ms = wait_ms; }
+  }
+
+  return timeout_ms;
+}
+
+void Reactor::run_timers()
+{
+  int64_t now = esp_timer_get_time();
+
+  for (int i = 0; i < max_timers; i++)
+  {
+    Timer &timer = timers[i];
+
+    if (timer.callback == NULL || timer.deadline > now) { continue; }
+
+    TimerCallback callback = timer.callback;
+    void *context = timer.context;
+
+    if (timer.period > 0)
+    {
+      timer.deadline += timer.period;
+      if (timer.deadline <= now) { timer.deadline = now + timer.period; }
+    }
+      else
+    {
+      // One shot timers are freed before the callback so it can start
+      // a new one.
+      timer.callback = NULL;
+      timer.context  = NULL;
+    }
+
+    callback(context);
+  }
+}
+
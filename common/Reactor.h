@@ -0,0 +1,101 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/select.h>
+
+// Single threaded event loop. Sockets and timers are registered with a
+// callback and run_once() waits for all of them with one select(). The
+// fd_sets are kept up to date by add() / modify() / remove() instead of
+// being rebuilt every time through the loop. Everything except wake()
+// must be called from the thread running the loop. The handler and
+// timer tables are sized by the owner and allocated once, so the tee can
+// keep small ones while the base makes room for all of its connections.
+class Reactor
+{
+public:
+  Reactor(
+    int max_handlers = DEFAULT_HANDLERS,
+    int max_timers = DEFAULT_TIMERS);
+  ~Reactor();
+
+  enum
+  {
+    EVENT_READ  = 1,
+    EVENT_WRITE = 2,
+  };
+
+  typedef void (*SocketCallback)(void *context, int socket_id, int events);
+  typedef void (*TimerCallback)(void *context);
+
+  int open(TimerCallback wake_callback = NULL, void *context = NULL);
+
+  int add(int socket_id, int events, SocketCallback callback, void *context);
+  int modify(int socket_id, int events);
+  void remove(int socket_id);
+
+  int timer_start(
+    int delay_ms,
+    int period_ms,
+    TimerCallback callback,
+    void *context);
+
+  void timer_stop(int id);
+
+  void wake();
+  void run_once(int max_wait_ms = -1);
+  void run();
+
+  static const int DEFAULT_HANDLERS = 24;
+  static const int DEFAULT_TIMERS = 16;
+
+private:
+  struct Handler
+  {
+    int socket_id;
+    int events;
+    SocketCallback callback;
+    void *context;
+  };
+
+  struct Timer
+  {
+    int64_t deadline;
+    int64_t period;
+    TimerCallback callback;
+    void *context;
+  };
+
+  int find(int socket_id);
+  void update_max();
+  int get_timeout_ms(int max_wait_ms);
+  void run_timers();
+
+  Handler *handlers;
+  Timer *timers;
+  int max_handlers;
+  int max_timers;
+  fd_set readset;
+  fd_set writeset;
+  int max_id;
+  int wake_id;
+  TimerCallback wake_callback;
+  void *wake_context;
+};
+
+#endif
+
@@ -0,0 +1,137 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#include "esp_log.h"
+
+#include "Scheduler.h"
+
+Scheduler::Scheduler(Reactor &reactor) : reactor { reactor }
+{
+}
+
+Scheduler::~Scheduler()
+{
+}
+
+void Scheduler::Signal::set()
+{
+  if (waiter != NULL)
+  {
+    waiter->finish(WAIT_SIGNAL);
+    return;
+  }
+
+  is_set = true;
+}
+
+Scheduler::Wait::Wait(
+  Scheduler &scheduler,
+  int socket_id,
+  int events,
+  Signal *signal,
+  int timeout_ms) :
+  scheduler  { scheduler },
+  socket_id  { socket_id },
+  events     { events },
+  signal     { signal },
+  timeout_ms { timeout_ms },
+  timer      { -1 },
+  result     { WAIT_TIMEOUT }
+{
+}
+
+bool Scheduler::Wait::await_ready()
+{
+  // A signal set while nothing was waiting is taken without suspending.
+  if (signal != NULL && signal->is_set)
+  {
+    signal->is_set = false;
+    result = WAIT_SIGNAL;
+    return true;
+  }
+
+  return timeout_ms == 0 && socket_id == -1;
+}
+
+bool Scheduler::Wait::await_suspend(std::coroutine_handle<> handle)
+{
+  // The Wait lives in the coroutine's frame until it's resumed, so the
+  // reactor can keep a pointer to it.
+  this->handle = handle;
+
+  Reactor &reactor = scheduler.reactor;
+
+  // Suspending without the socket would never resume, and without the
+  // timer the wait would lose its timeout. Either way the coroutine
+  // carries on right away with WAIT_ERROR.
+  if (socket_id != -1)
+  {
+    if (reactor.add(socket_id, events, on_socket, this) != 0)
+    {
+      result = WAIT_ERROR;
+      return false;
+    }
+  }
+
+  if (timeout_ms >= 0)
+  {
+    timer = reactor.timer_start(timeout_ms, 0, on_timer, this);
+
+    if (timer == -1)
+    {
+      ESP_LOGE("scheduler", "No timer for a %d ms wait.", timeout_ms);
+
+      if (socket_id != -1) { reactor.remove(socket_id); }
+
+      result = WAIT_ERROR;
+      return false;
+    }
+  }
+
+  if (signal != NULL) { signal->waiter = this; }
+
+  return true;
+}
+
+void Scheduler::Wait::finish(int result)
+{
+  Reactor &reactor = scheduler.reactor;
+
+  // Undo everything that could resume this wait a second time before
+  // handing control back to the coroutine, which may reuse the socket
+  // or the signal right away. Nothing here can touch this object after
+  // resume() since the coroutine frees it.
+  if (socket_id != -1) { reactor.remove(socket_id); }
+  if (timer != -1) { reactor.timer_stop(timer); }
+  if (signal != NULL) { signal->waiter = NULL; }
+
+  this->result = result;
+
+  handle.resume();
+}
+
+void Scheduler::Wait::on_socket(void *context, int socket_id, int events)
+{
+  Wait *wait = (Wait *)context;
+  wait->finish(events);
+}
+
+void Scheduler::Wait::on_timer(void *context)
+{
+  Wait *wait = (Wait *)context;
+
+  // One shot timers are already freed when the callback runs.
+  wait->timer = -1;
+  wait->finish(WAIT_TIMEOUT);
+}
+
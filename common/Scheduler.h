@@ -0,0 +1,154 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <coroutine>
+
+#include "Reactor.h"
+
+// Runs C++20 coroutines on top of a Reactor so connection handling can be
+// written as straight line code (connect, wait, retry) instead of a set
+// of callbacks. A coroutine suspends with co_await on a socket, a Signal
+// or a timeout, and is resumed from the reactor's thread when the first
+// of those happens. Like the Reactor, nothing here is thread safe: other
+// tasks call reactor.wake() and the wake callback sets a Signal.
+class Scheduler
+{
+public:
+  Scheduler(Reactor &reactor);
+  ~Scheduler();
+
+  // Result of a wait: the socket events that were ready, WAIT_SIGNAL, or
+  // WAIT_TIMEOUT. WAIT_ERROR means the reactor had no room for the
+  // socket or the timer, the wait returns right away without suspending.
+  // Waiting again would most likely fail the same way.
+  enum
+  {
+    WAIT_TIMEOUT = 0,
+    WAIT_READ    = Reactor::EVENT_READ,
+    WAIT_WRITE   = Reactor::EVENT_WRITE,
+    WAIT_SIGNAL  = 4,
+    WAIT_ERROR   = 8,
+  };
+
+  // Return type of every coroutine run by the scheduler. It starts
+  // suspended, spawn() runs it up to its first co_await, and the frame
+  // frees itself when the coroutine returns.
+  class Task
+  {
+  public:
+    struct promise_type
+    {
+      Task get_return_object()
+      {
+        return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+      }
+
+      std::suspend_always initial_suspend() { return { }; }
+      std::suspend_never final_suspend() noexcept { return { }; }
+      void return_void() { }
+      void unhandled_exception() { abort(); }
+    };
+
+    Task(std::coroutine_handle<promise_type> handle) : handle { handle } { }
+
+    std::coroutine_handle<promise_type> handle;
+  };
+
+  class Wait;
+
+  // Wakes one waiting coroutine. If nothing is waiting it stays set until
+  // the next wait, so a set() is never lost.
+  class Signal
+  {
+  public:
+    Signal() : is_set { false }, waiter { NULL } { }
+
+    void set();
+
+  private:
+    friend class Wait;
+
+    bool is_set;
+    Wait *waiter;
+  };
+
+  class Wait
+  {
+  public:
+    Wait(
+      Scheduler &scheduler,
+      int socket_id,
+      int events,
+      Signal *signal,
+      int timeout_ms);
+
+    bool await_ready();
+    bool await_suspend(std::coroutine_handle<> handle);
+    int await_resume() { return result; }
+
+  private:
+    friend class Signal;
+
+    void finish(int result);
+
+    static void on_socket(void *context, int socket_id, int events);
+    static void on_timer(void *context);
+
+    Scheduler &scheduler;
+    std::coroutine_handle<> handle;
+    int socket_id;
+    int events;
+    Signal *signal;
+    int timeout_ms;
+    int timer;
+    int result;
+  };
+
+  void spawn(Task task) { task.handle.resume(); }
+
+  // A timeout_ms of -1 waits forever.
+  Wait wait_socket(int socket_id, int events, int timeout_ms = -1)
+  {
+    return Wait(*this, socket_id, events, NULL, timeout_ms);
+  }
+
+  Wait wait_signal(Signal &signal, int timeout_ms = -1)
+  {
+    return Wait(*this, -1, 0, &signal, timeout_ms);
+  }
+
+  Wait wait_socket_or_signal(
+    int socket_id,
+    int events,
+    Signal &signal,
+    int timeout_ms = -1)
+  {
+    return Wait(*this, socket_id, events, &signal, timeout_ms);
+  }
+
+  Wait sleep(int timeout_ms)
+  {
+    return Wait(*this, -1, 0, NULL, timeout_ms);
+  }
+
+private:
+  Reactor &reactor;
+};
+
+#endif
+
@@ -0,0 +1,134 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <errno.h>
+
+#include "esp_log.h"
+
+#include "SocketTransport.h"
+
+SocketTransport::SocketTransport(int type, const char *address, int port) :
+  type         { type },
+  address      { address },
+  port         { port },
+  socket_id    { -1 },
+  peer_address { 0 }
+{
+}
+
+SocketTransport::~SocketTransport()
+{
+  close();
+}
+
+void SocketTransport::set_address(const char *address, int port)
+{
+  this->address = address;
+  this->port = port;
+}
+
+void SocketTransport::attach(int socket_id, uint32_t address)
+{
+  close();
+
+  fcntl(socket_id, F_SETFL, O_NONBLOCK);
+
+  if (type == SOCK_STREAM) { set_keepalive(socket_id); }
+
+  this->socket_id = socket_id;
+  this->peer_address = address;
+}
+
+int SocketTransport::open()
+{
+  close();
+
+  int sockfd = socket(AF_INET, type, 0);
+
+  if (sockfd < 0)
+  {
+    ESP_LOGI(
+      "net_connect",
+      "Can't create socket.\n");
+    return -2;
+  }
+
+  fcntl(sockfd, F_SETFL, O_NONBLOCK);
+
+  if (type == SOCK_STREAM) { set_keepalive(sockfd); }
+
+  struct sockaddr_in addr;
+  memset((char*)&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  inet_pton(AF_INET, address, &addr.sin_addr);
+  addr.sin_port = htons(port);
+
+  // Non-blocking connect for TCP. Connecting a UDP socket only sets the
+  // default address so send() and recv() talk to the base and nothing
+  // else.
+  if (connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 &&
+      errno != EINPROGRESS)
+  {
+    ESP_LOGI(
+      "net_connect",
+      "Could not connect");
+    ::close(sockfd);
+    return -3;
+  }
+
+  socket_id = sockfd;
+  peer_address = addr.sin_addr.s_addr;
+
+  return 0;
+}
+
+int SocketTransport::get_open_error()
+{
+  int error = 0;
+  socklen_t length = sizeof(error);
+
+  getsockopt(socket_id, SOL_SOCKET, SO_ERROR, &error, &length);
+
+  return error;
+}
+
+Network::Status SocketTransport::send(
+  const uint8_t *buffer,
+  int length,
+  int64_t deadline,
+  int *count,
+  Network::Cancel *cancel)
+{
+  return net_send_until(socket_id, buffer, length, deadline, count, cancel);
+}
+
+Network::Status SocketTransport::poll(uint8_t *buffer, int length, int *count)
+{
+  // A deadline of 0 has already passed, so this never waits.
+  return net_recv_until(socket_id, buffer, length, 0, count);
+}
+
+void SocketTransport::close()
+{
+  if (socket_id == -1) { return; }
+
+  net_close(socket_id);
+
+  socket_id = -1;
+}
+
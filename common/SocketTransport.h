@@ -0,0 +1,61 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#ifndef SOCKET_TRANSPORT_H
+#define SOCKET_TRANSPORT_H
+
+#include <stdint.h>
+
+#include "Network.h"
+#include "Transport.h"
+
+// Transport over a BSD socket. type is SOCK_STREAM for the TCP control
+// connection or SOCK_DGRAM for events over UDP, where every send() is one
+// datagram. open() connects to address:port, or attach() takes a socket
+// that was already accepted.
+class SocketTransport : public Transport, protected Network
+{
+public:
+  SocketTransport(int type, const char *address = NULL, int port = 0);
+  ~SocketTransport() override;
+
+  void set_address(const char *address, int port);
+  void attach(int socket_id, uint32_t address);
+
+  int open() override;
+  int get_open_error() override;
+
+  Network::Status send(
+    const uint8_t *buffer,
+    int length,
+    int64_t deadline,
+    int *count,
+    Network::Cancel *cancel = NULL) override;
+
+  Network::Status poll(uint8_t *buffer, int length, int *count) override;
+
+  void close() override;
+
+  int get_id() override { return socket_id; }
+  uint32_t get_address() override { return peer_address; }
+
+private:
+  int type;
+  const char *address;
+  int port;
+  int socket_id;
+  uint32_t peer_address;
+};
+
+#endif
+
@@ -0,0 +1,71 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdint.h>
+
+#include "Network.h"
+
+// One end of a link between a tee and the base. The tee's connections
+// and the base's control connections go through this, so the same
+// protocol code runs over TCP or UDP sockets (SocketTransport) or lwIP
+// netconns (NetconnTransport). The base's UDP port is one socket shared
+// by every tee and still uses recvfrom() and sendto() directly.
+// get_id() is a descriptor the Reactor can wait on: readable when poll()
+// has data, writable once open() finished.
+class Transport
+{
+public:
+  virtual ~Transport() { }
+
+  // Starts opening the link without blocking. When get_id() becomes
+  // writable get_open_error() says if it worked.
+  virtual int open() = 0;
+  virtual int get_open_error() { return 0; }
+
+  virtual Network::Status send(
+    const uint8_t *buffer,
+    int length,
+    int64_t deadline,
+    int *count,
+    Network::Cancel *cancel = NULL) = 0;
+
+  // Takes whatever already arrived, NET_TIMEOUT if there's nothing.
+  virtual Network::Status poll(uint8_t *buffer, int length, int *count) = 0;
+
+  // Transports that can hand out their own receive buffers (the lwIP
+  // pbufs) instead of copying. poll_view() points at the next bytes that
+  // arrived and consume() releases them.
+  virtual bool has_view() { return false; }
+
+  virtual Network::Status poll_view(const uint8_t **data, int *count)
+  {
+    return Network::NET_ERROR;
+  }
+
+  virtual void consume(int count) { }
+
+  virtual void close() = 0;
+
+  virtual int get_id() = 0;
+
+  // Identifies the far end (an IPv4 address for sockets).
+  virtual uint32_t get_address() = 0;
+
+  bool is_open() { return get_id() != -1; }
+};
+
+#endif
+
@@ -41,7 +41,9 @@ GolfGameTee::~GolfGameTee()
 
 void GolfGameTee::run()
 {
-  NetworkClient network_client;
+  // Static since its Reactor, send queue and clock sync don't fit next
+  // to Wi-Fi and the RFID code on the default 3.5K main task stack.
+  static NetworkClient network_client;
 
   network_client.start();
 
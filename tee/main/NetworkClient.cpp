@@ -16,6 +16,7 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <errno.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -23,20 +24,55 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
 
 #include "NetworkClient.h"
-
-NetworkClient::NetworkClient() : socket_id { -1 }
+#include "Protocol.h"
+
+NetworkClient::NetworkClient() :
+  control_pid        { 0 },
+  scheduler          { reactor },
+  has_ip             { false },
+  link_event         { false },
+  drop_connection    { false },
+  use_udp            { false },
+  retry_delay_ms     { RETRY_DELAY_MIN_MS },
+  udp_failures       { 0 },
+  udp_blocked_time   { 0 },
+  next_sequence      { 0 },
+  heartbeat_sequence { 0 },
+  last_heard         { 0 },
+  rx_length          { 0 },
+  tcp                { SOCK_STREAM, BASE_ADDRESS, CONTROL_PORT },
+  udp                { SOCK_DGRAM, BASE_ADDRESS, CONTROL_UDP_PORT },
+  control            { &tcp },
+  datagram           { &udp },
+  connected          { false }
 {
+  pthread_mutex_init(&lock, NULL);
 }
 
 NetworkClient::~NetworkClient()
 {
+  pthread_mutex_destroy(&lock);
 }
 
-int NetworkClient::start()
+int NetworkClient::start(bool use_udp)
 {
+  this->use_udp = use_udp;
+
+  // Opened before Wi-Fi starts so the event handler can always use it.
+  cancel.open();
+
   start_wifi();
+
+  // Start at a random sequence so the base doesn't take events sent
+  // after a reboot of the tee as duplicates of old ones. Only once the
+  // radio is running is esp_random() a true random number, before that
+  // it can repeat from boot to boot.
+  next_sequence = esp_random() & 0xffff;
+
   start_network_thread();
 
   return 0;
@@ -61,14 +97,14 @@ int NetworkClient::start_wifi()
     WIFI_EVENT,
     ESP_EVENT_ANY_ID,
     &wifi_event_handler,
-    NULL,
+    this,
     NULL));
 
   ESP_ERROR_CHECK(esp_event_handler_instance_register(
     IP_EVENT,
-    IP_EVENT_STA_GOT_IP,
+    ESP_EVENT_ANY_ID,
     &wifi_event_handler,
-    NULL,
+    this,
     NULL));
 
   wifi_config_t wifi_config = { };
@@ -92,19 +128,34 @@ int NetworkClient::start_wifi()
 
 int NetworkClient::start_network_thread()
 {
+  // Opened here rather than in the thread so wake() works as soon as the
+  // Wi-Fi events start coming in.
+  if (reactor.open(on_wake, this) != 0) { return -1; }
+
   pthread_create(&control_pid, NULL, control_thread, this);
+
   return 0;
 }
 
 int NetworkClient::start_player(int value)
 {
-  uint8_t buffer[1];
+  // This is called from the RFID loop so it only queues the event. The
+  // network thread does the actual send.
+  pthread_mutex_lock(&lock);
+  bool queued = send_queue.push(value, next_sequence, esp_timer_get_time());
+  if (queued) { next_sequence++; }
+  int count = send_queue.get_count();
+  pthread_mutex_unlock(&lock);
 
-  buffer[0] = value;
+  reactor.wake();
 
-  ESP_LOGI("wifi", "start_player(%d)", value);
+  if (! queued)
+  {
+    ESP_LOGE("wifi", "start_player(%d) send queue full", value);
+    return -1;
+  }
 
-  Network::net_send(socket_id, buffer, sizeof(buffer));
+  ESP_LOGI("wifi", "start_player(%d) queued=%d", value, count);
 
   return 0;
 }
@@ -115,7 +166,9 @@ void NetworkClient::wifi_event_handler(
   int32_t event_id,
   void *event_data)
 {
-  if (event_id == WIFI_EVENT_STA_START)
+  NetworkClient *network_client = (NetworkClient *)arg;
+
+  if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
   {
     ESP_LOGI(
       "wifi",
@@ -124,15 +177,15 @@ void NetworkClient::wifi_event_handler(
     esp_wifi_connect();
   }
     else
-  if (event_id == WIFI_EVENT_STA_DISCONNECTED)
+  if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
   {
-    //sleep(2);
+    network_client->set_link(false);
     esp_wifi_connect();
 
     ESP_LOGI("wifi", "Disconnected.. retry to connect to the AP");
   }
     else
-  if (event_id == IP_EVENT_STA_GOT_IP)
+  if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
   {
     ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
 
@@ -140,94 +193,681 @@ void NetworkClient::wifi_event_handler(
       "wifi",
       "got ip:" IPSTR,
       IP2STR(&event->ip_info.ip));
+
+    network_client->set_link(true);
   }
+    else
+  if (event_base == IP_EVENT && event_id == IP_EVENT_STA_LOST_IP)
+  {
+    network_client->set_link(false);
+  }
+}
+
+bool NetworkClient::has_link()
+{
+  pthread_mutex_lock(&lock);
+  bool value = has_ip;
+  pthread_mutex_unlock(&lock);
+
+  return value;
+}
+
+void NetworkClient::set_link(bool value)
+{
+  pthread_mutex_lock(&lock);
+
+  has_ip = value;
+  link_event = true;
+
+  // A new lease means the base is reachable again, so skip whatever is
+  // left of the backoff and connect right away.
+  if (has_ip) { retry_delay_ms = RETRY_DELAY_MIN_MS; }
+
+  pthread_mutex_unlock(&lock);
+
+  // A send waiting on a dead link gives up now instead of at its
+  // deadline, then the connection task drops the connection (or
+  // reconnects) as soon as the network thread wakes up.
+  if (! value) { cancel.cancel(); }
+
+  reactor.wake();
+}
+
+void NetworkClient::net_connected()
+{
+  pthread_mutex_lock(&lock);
+  connected = true;
+  retry_delay_ms = RETRY_DELAY_MIN_MS;
+  send_queue.resend_all();
+
+  // The base may have rebooted and started its clock over, so nothing
+  // measured before is any good.
+  clock.reset();
+  pthread_mutex_unlock(&lock);
+
+  rx_length = 0;
+  last_heard = esp_timer_get_time();
+  drop_connection = false;
+  cancel.reset();
+
+  ESP_LOGI("control_run", "Connected id=%d.\n", control->get_id());
 }
 
-int NetworkClient::net_connect()
+void NetworkClient::net_disconnect()
 {
-  int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  if (! connected) { return; }
 
-  if (sockfd < 0)
+  ESP_LOGI("control_run", "Disconnected.\n");
+
+  pthread_mutex_lock(&lock);
+  control->close();
+  connected = false;
+  pthread_mutex_unlock(&lock);
+}
+
+int NetworkClient::send_queued(int64_t now)
+{
+  uint8_t buffer[SEND_BATCH * Protocol::START_PLAYER_SIZE];
+
+  while (true)
   {
-    ESP_LOGI(
-      "net_connect",
-      "Can't create socket.\n");
-    return -2;
+    int count = 0;
+    int events = 0;
+    int length = 0;
+
+    // Encode the events that still need TCP (up to SEND_BATCH) straight
+    // into one buffer so they share a single TCP segment. Events already
+    // acked over UDP are skipped, and one still in flight on UDP stops
+    // the batch so TCP keeps the order. The lock isn't held during the
+    // send. Events stay queued until the base acks them so if the link
+    // drops they are sent again after reconnecting.
+    pthread_mutex_lock(&lock);
+
+    while (events < SEND_BATCH)
+    {
+      SendQueue::Event *event = send_queue.get(send_queue.get_sent() + count);
+
+      if (event == NULL) { break; }
+
+      if (! event->acked)
+      {
+        if (! is_tcp_needed(*event, now)) { break; }
+
+        length += Protocol::encode_start_player(
+          buffer + length,
+          sizeof(buffer) - length,
+          event->sequence,
+          event->timestamp,
+          event->player);
+
+        events++;
+      }
+
+      count++;
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    if (count == 0) { return 0; }
+
+    if (length != 0)
+    {
+      // A send that doesn't finish in time leaves part of a frame in the
+      // stream, so any failure drops the connection. The events are sent
+      // again after reconnecting.
+      int sent;
+
+      Status status = control->send(
+        buffer,
+        length,
+        get_deadline(SEND_TIMEOUT_MS),
+        &sent,
+        &cancel);
+
+      if (status != NET_OK)
+      {
+        ESP_LOGE("control_run", "Send %s after %d of %d bytes.",
+          get_status_name(status), sent, length);
+        return -1;
+      }
+
+      ESP_LOGI("control_run", "Sent %d event(s) in %d bytes.", events, length);
+    }
+
+    pthread_mutex_lock(&lock);
+    send_queue.mark_sent(count);
+    pthread_mutex_unlock(&lock);
   }
+}
 
-  struct sockaddr_in addr;
-  memset((char*)&addr, 0, sizeof(addr));
-  addr.sin_family = AF_INET;
-  inet_pton(AF_INET, "192.168.4.1", &addr.sin_addr);
-  addr.sin_port = htons(CONTROL_PORT);
+int64_t NetworkClient::get_clock_offset(int64_t *uncertainty)
+{
+  int64_t now = esp_timer_get_time();
+
+  pthread_mutex_lock(&lock);
+  int64_t offset = clock.get_offset(now);
+  if (uncertainty != NULL) { *uncertainty = clock.get_uncertainty(now); }
+  pthread_mutex_unlock(&lock);
+
+  return offset;
+}
 
-  if (connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+int NetworkClient::send_heartbeat(int64_t now)
+{
+  uint8_t buffer[Protocol::HEARTBEAT_SIZE];
+  int sent;
+
+  // Each heartbeat carries the current estimate so the base can map
+  // event timestamps into its own clock.
+  pthread_mutex_lock(&lock);
+  int64_t offset = clock.get_offset(now);
+  int64_t uncertainty = clock.get_uncertainty(now);
+  int32_t drift_ppb = clock.get_drift();
+  pthread_mutex_unlock(&lock);
+
+  if (uncertainty < 0 || uncertainty >= Protocol::UNCERTAINTY_UNKNOWN)
   {
-    ESP_LOGI(
-      "net_connect",
-      "Could not connect");
-    close(sockfd);
-    return -3;
+    uncertainty = Protocol::UNCERTAINTY_UNKNOWN;
   }
 
-  fcntl(sockfd, F_SETFL, O_NONBLOCK);
+  int length = Protocol::encode_heartbeat(
+    buffer,
+    sizeof(buffer),
+    heartbeat_sequence++,
+    now,
+    offset,
+    uncertainty,
+    drift_ppb);
+
+  Status status = control->send(
+    buffer,
+    length,
+    get_deadline(SEND_TIMEOUT_MS),
+    &sent,
+    &cancel);
+
+  return status == NET_OK ? 0 : -1;
+}
 
-  return sockfd;
+int NetworkClient::receive_messages()
+{
+  // Only reads what already arrived.
+  int n;
+
+  Status status = control->poll(
+    rx_buffer + rx_length,
+    sizeof(rx_buffer) - rx_length,
+    &n);
+
+  if (status == NET_TIMEOUT) { return 0; }
+  if (status != NET_OK) { return -1; }
+
+  // Anything from the base (acks or heartbeat replies) shows it's alive.
+  rx_length += n;
+  last_heard = esp_timer_get_time();
+
+  int offset = 0;
+
+  while (true)
+  {
+    Protocol::Message message;
+
+    int used = Protocol::decode(
+      rx_buffer + offset,
+      rx_length - offset,
+      message);
+
+    if (used < 0)
+    {
+      ESP_LOGE("control_run", "Bad frame from base.");
+      return -1;
+    }
+
+    if (used == 0) { break; }
+
+    offset += used;
+
+    int64_t t1;
+    int64_t t2;
+
+    if (Protocol::decode_heartbeat_reply(message, t1, t2) == 0)
+    {
+      // last_heard is when this reply came in (t4).
+      pthread_mutex_lock(&lock);
+      clock.add_sample(t1, t2, message.timestamp, last_heard);
+      pthread_mutex_unlock(&lock);
+
+      ESP_LOGD("control_run", "Clock offset %lld us +/-%lld drift %d ppb.",
+        clock.get_offset(last_heard),
+        clock.get_uncertainty(last_heard),
+        clock.get_drift());
+
+      continue;
+    }
+
+    uint16_t acked;
+
+    if (Protocol::decode_ack(message, acked) == 0)
+    {
+      int64_t now = esp_timer_get_time();
+
+      pthread_mutex_lock(&lock);
+
+      // Acks on TCP are cumulative.
+      for (int i = 0; i < send_queue.get_sent(); i++)
+      {
+        SendQueue::Event *event = send_queue.get(i);
+
+        if (Protocol::is_after(event->sequence, acked)) { break; }
+        if (event->acked) { continue; }
+
+        event_delivered(*event, latency_tcp, "tcp", now);
+      }
+
+      send_queue.pop_acked();
+
+      pthread_mutex_unlock(&lock);
+    }
+  }
+
+  rx_length -= offset;
+  memmove(rx_buffer, rx_buffer + offset, rx_length);
+
+  return 0;
 }
 
-void NetworkClient::control_run()
+int NetworkClient::udp_send_pending(int64_t now, int64_t &next_time)
 {
+  if (! is_udp_usable(now)) { return 0; }
+
+  uint8_t buffer[SEND_BATCH * Protocol::START_PLAYER_SIZE];
+  int length = 0;
+
+  pthread_mutex_lock(&lock);
+
+  // Every event that is new or due for a retransmit goes out in one
+  // datagram. Events already handed to TCP are left alone.
+  for (int i = send_queue.get_sent(); i < send_queue.get_count(); i++)
+  {
+    SendQueue::Event *event = send_queue.get(i);
+
+    if (event->acked || event->attempts > UDP_MAX_ATTEMPTS) { continue; }
+
+    if (event->retry_time > now)
+    {
+      if (event->retry_time < next_time) { next_time = event->retry_time; }
+      continue;
+    }
+
+    if (event->attempts == UDP_MAX_ATTEMPTS)
+    {
+      // No ack after the last retransmit, leave this one to TCP.
+      event->attempts++;
+      udp_failures++;
+      continue;
+    }
+
+    if (length + Protocol::START_PLAYER_SIZE > (int)sizeof(buffer))
+    {
+      next_time = now;
+      break;
+    }
+
+    length += Protocol::encode_start_player(
+      buffer + length,
+      sizeof(buffer) - length,
+      event->sequence,
+      event->timestamp,
+      event->player);
+
+    event->retry_time = now + ((int64_t)UDP_RETRY_MS * 1000 << event->attempts);
+    event->attempts++;
+
+    if (event->retry_time < next_time) { next_time = event->retry_time; }
+  }
+
+  if (udp_failures >= UDP_MAX_FAILURES)
+  {
+    ESP_LOGW("control_run", "No UDP acks, using TCP for %d ms.",
+      UDP_BLOCKED_MS);
+
+    udp_blocked_time = now + (int64_t)UDP_BLOCKED_MS * 1000;
+    udp_failures = 0;
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  if (length == 0) { return 0; }
+
+  // Errors aren't fatal here, the retransmit timer or TCP covers them.
+  int sent;
+
+  return datagram->send(buffer, length, 0, &sent) == NET_OK ? sent : -1;
+}
+
+void NetworkClient::udp_receive()
+{
+  uint8_t buffer[Protocol::MAX_FRAME * 2];
+
   while (true)
   {
-    ESP_LOGI(
-      "control_run",
-      "Attempting to connect\n");
+    int n;
 
-    socket_id = net_connect();
+    if (datagram->poll(buffer, sizeof(buffer), &n) != NET_OK) { return; }
 
-    ESP_LOGI(
-      "control_run",
-      "  .. connect socket_id=%d\n",
-      socket_id);
+    int offset = 0;
+
+    while (offset < n)
+    {
+      Protocol::Message message;
+
+      int used = Protocol::decode(buffer + offset, n - offset, message);
+
+      if (used <= 0) { break; }
+
+      offset += used;
+
+      uint16_t highest;
+      uint32_t mask;
+
+      if (Protocol::decode_sack(message, highest, mask) != 0) { continue; }
+
+      int64_t now = esp_timer_get_time();
+
+      pthread_mutex_lock(&lock);
+
+      udp_failures = 0;
+
+      for (int i = 0; i < send_queue.get_count(); i++)
+      {
+        SendQueue::Event *event = send_queue.get(i);
+
+        if (event->acked) { continue; }
+
+        if (Protocol::is_in_sack(event->sequence, highest, mask))
+        {
+          event_delivered(*event, latency_udp, "udp", now);
+        }
+      }
+
+      send_queue.pop_acked();
+
+      pthread_mutex_unlock(&lock);
+    }
+  }
+}
+
+bool NetworkClient::is_udp_usable(int64_t now)
+{
+  return use_udp &&
+    datagram != NULL &&
+    datagram->is_open() &&
+    now >= udp_blocked_time;
+}
+
+bool NetworkClient::is_tcp_needed(const SendQueue::Event &event, int64_t now)
+{
+  return ! is_udp_usable(now) || event.attempts > UDP_MAX_ATTEMPTS;
+}
 
-    if (socket_id < 0)
+void NetworkClient::event_delivered(
+  SendQueue::Event &event,
+  Latency &latency,
+  const char *name,
+  int64_t now)
+{
+  // Time from the tap to the base's ack, so the two transports can be
+  // compared on real hardware.
+  int64_t delay = now - event.timestamp;
+
+  event.acked = true;
+
+  latency.count++;
+  latency.total += delay;
+  if (delay > latency.max) { latency.max = delay; }
+
+  ESP_LOGI("control_run",
+    "seq=%d delivered over %s in %lld us (count=%d avg=%lld max=%lld).",
+    event.sequence,
+    name,
+    delay,
+    latency.count,
+    latency.total / latency.count,
+    latency.max);
+}
+
+int NetworkClient::get_retry_delay()
+{
+  pthread_mutex_lock(&lock);
+
+  // Equal jitter: wait between half and all of the current delay so
+  // several tees coming back from the same AP reset don't connect in
+  // lock step.
+  int delay_ms = retry_delay_ms / 2 + esp_random() % (retry_delay_ms / 2 + 1);
+
+  retry_delay_ms = retry_delay_ms * 2;
+
+  if (retry_delay_ms > RETRY_DELAY_MAX_MS)
+  {
+    retry_delay_ms = RETRY_DELAY_MAX_MS;
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  ESP_LOGI("control_run", "Retry in %d ms.", delay_ms);
+
+  return delay_ms;
+}
+
+Scheduler::Task NetworkClient::connection_task()
+{
+  while (true)
+  {
+    // Nothing can be reached until DHCP finishes, so don't burn connect
+    // attempts before IP_EVENT_STA_GOT_IP.
+    if (! has_link())
     {
-      socket_id = -1;
-      sleep(4);
+      co_await scheduler.wait_signal(link_changed);
       continue;
     }
 
-    ESP_LOGI("control_run", "Connected.\n");
+    if (use_udp && datagram != NULL && ! datagram->is_open())
+    {
+      if (datagram->open() == 0) { scheduler.spawn(udp_task()); }
+    }
+
+    ESP_LOGI(
+      "control_run",
+      "Attempting to connect\n");
+
+    bool is_open = control->open() == 0;
 
-    while (true)
+    if (is_open)
     {
-      uint8_t buffer[1];
+      // Writable means the handshake finished. The short timeout gives
+      // up rather than waiting for the full TCP SYN retry schedule.
+      int result = co_await scheduler.wait_socket_or_signal(
+        control->get_id(),
+        Scheduler::WAIT_WRITE,
+        link_changed,
+        CONNECT_TIMEOUT_MS);
+
+      int error = 0;
+
+      if (result == Scheduler::WAIT_WRITE)
+      {
+        error = control->get_open_error();
+      }
+
+      if (result != Scheduler::WAIT_WRITE || error != 0)
+      {
+        ESP_LOGI(
+          "net_connect",
+          "Could not connect result=%d error=%d", result, error);
+
+        control->close();
+        is_open = false;
+      }
+    }
 
-      buffer[1] = 'X';
+    if (is_open)
+    {
+      net_connected();
 
-      int length = net_recv(socket_id, buffer, 1);
+      // Flush anything queued while disconnected.
+      send_ready.set();
 
-      if (length == 0 || length == -5) { continue; }
-      if (length < 0) { break; }
+      // Acks come in here, this also notices the base closing the
+      // connection. A link change or the sender giving up on the
+      // connection wakes it too. The base answers every heartbeat, so
+      // if it loses power or the AP goes away the connection is dropped
+      // after HEARTBEAT_MISSES intervals instead of minutes later.
+      int64_t heartbeat_time = 0;
 
-#if 0
-      switch (buffer[0])
+      while (true)
       {
-        case 'S':
-          reset();
+        int64_t now = esp_timer_get_time();
+        int64_t dead_time = get_dead_time(last_heard);
+
+        if (now >= dead_time)
+        {
+          ESP_LOGW("control_run", "Base missed %d heartbeats.",
+            HEARTBEAT_MISSES);
           break;
+        }
+
+        if (now >= heartbeat_time)
+        {
+          if (send_heartbeat(now) != 0) { break; }
+          heartbeat_time = now + HEARTBEAT_INTERVAL_MS * 1000;
+        }
+
+        int64_t next_time =
+          heartbeat_time < dead_time ? heartbeat_time : dead_time;
+
+        int result = co_await scheduler.wait_socket_or_signal(
+          control->get_id(),
+          Scheduler::WAIT_READ,
+          link_changed,
+          (next_time - now + 999) / 1000);
+
+        if (result == Scheduler::WAIT_TIMEOUT) { continue; }
+
+        // Without its timeout a dead base would never be noticed.
+        if (result == Scheduler::WAIT_ERROR) { break; }
+
+        if (result == Scheduler::WAIT_SIGNAL)
+        {
+          if (! has_link() || drop_connection) { break; }
+          continue;
+        }
+
+        if (receive_messages() != 0) { break; }
       }
-#endif
+
+      net_disconnect();
+    }
+
+    // A new lease ends the backoff early.
+    if (has_link())
+    {
+      int result =
+        co_await scheduler.wait_signal(link_changed, get_retry_delay());
+
+      // Retrying right away would spin on this thread and the timer
+      // would never come free, so only a link change can retry.
+      if (result == Scheduler::WAIT_ERROR)
+      {
+        ESP_LOGE("control_run", "No timer for the retry delay.");
+        co_await scheduler.wait_signal(link_changed);
+      }
+    }
+  }
+}
+
+Scheduler::Task NetworkClient::sender_task()
+{
+  // Runs whenever a tap is queued, a connection comes up, or a UDP
+  // retransmit is due.
+  while (true)
+  {
+    int64_t now = esp_timer_get_time();
+    int64_t next_time = INT64_MAX;
+
+    // UDP goes first so events that just ran out of UDP attempts are
+    // picked up by TCP in the same pass.
+    if (has_link()) { udp_send_pending(now, next_time); }
+
+    // Flush anything queued while disconnected (in order) along with
+    // new taps. The connection task drops the connection and reconnects
+    // if this fails.
+    if (connected && ! drop_connection && send_queued(now) != 0)
+    {
+      drop_connection = true;
+      link_changed.set();
     }
 
-    ESP_LOGI("control_run", "Disconnected.\n");
+    int timeout_ms = -1;
+
+    if (next_time != INT64_MAX)
+    {
+      timeout_ms = next_time <= now ? 0 : (next_time - now + 999) / 1000;
+    }
 
-    Network::net_close(socket_id);
+    int result = co_await scheduler.wait_signal(send_ready, timeout_ms);
 
-    socket_id = -1;
+    // Same as above, the UDP retransmits wait for the next tap.
+    if (result == Scheduler::WAIT_ERROR)
+    {
+      ESP_LOGE("control_run", "No timer for the UDP retransmits.");
+      co_await scheduler.wait_signal(send_ready);
+    }
   }
 }
 
+Scheduler::Task NetworkClient::udp_task()
+{
+  // The UDP socket stays open for good, it doesn't depend on the link.
+  while (true)
+  {
+    int result = co_await scheduler.wait_socket(
+      datagram->get_id(),
+      Scheduler::WAIT_READ);
+
+    // UDP acks stop, so events go over TCP after their UDP attempts.
+    if (result == Scheduler::WAIT_ERROR)
+    {
+      ESP_LOGE("control_run", "UDP receive stopped, no reactor handler.");
+      break;
+    }
+
+    udp_receive();
+  }
+}
+
+void NetworkClient::control_run()
+{
+  // Everything on the network side runs as coroutines on this thread.
+  scheduler.spawn(connection_task());
+  scheduler.spawn(sender_task());
+
+  reactor.run();
+}
+
+void NetworkClient::on_wake(void *context)
+{
+  NetworkClient *network_client = (NetworkClient *)context;
+
+  pthread_mutex_lock(&network_client->lock);
+  bool link_event = network_client->link_event;
+  network_client->link_event = false;
+  pthread_mutex_unlock(&network_client->lock);
+
+  if (link_event) { network_client->link_changed.set(); }
+
+  network_client->send_ready.set();
+}
+
 void *NetworkClient::control_thread(void *context)
 {
   NetworkClient *network_end = (NetworkClient *)context;
@@ -19,7 +19,13 @@
 #include "esp_event.h"
 #include "esp_wifi.h"
 
+#include "ClockSync.h"
 #include "Network.h"
+#include "Reactor.h"
+#include "Scheduler.h"
+#include "SendQueue.h"
+#include "SocketTransport.h"
+#include "Transport.h"
 
 class NetworkClient : public Network
 {
@@ -27,27 +33,106 @@ public:
   NetworkClient();
   ~NetworkClient();
 
-  int start();
+  int start(bool use_udp = true);
   int start_network_thread();
   int start_wifi();
   int start_player(int value);
 
-  bool is_connected() { return socket_id > 0; }
+  // Goes false within HEARTBEAT_INTERVAL_MS * HEARTBEAT_MISSES of the
+  // base going away.
+  bool is_connected() { return connected; }
+
+  // Offset of the base's clock in microseconds, base time minus tee time.
+  // uncertainty is -1 until the first heartbeat reply.
+  int64_t get_clock_offset(int64_t *uncertainty = NULL);
 
 private:
+  struct Latency
+  {
+    Latency() : count { 0 }, total { 0 }, max { 0 } { }
+
+    int count;
+    int64_t total;
+    int64_t max;
+  };
+
   static void wifi_event_handler(
     void *arg,
     esp_event_base_t event_base,
     int32_t event_id,
     void *event_data);
 
-  int net_connect();
+  bool has_link();
+  void set_link(bool value);
+  void net_connected();
+  void net_disconnect();
+  int get_retry_delay();
+  int send_queued(int64_t now);
+  int send_heartbeat(int64_t now);
+  int receive_messages();
+  int udp_send_pending(int64_t now, int64_t &next_time);
+  void udp_receive();
+  bool is_udp_usable(int64_t now);
+  bool is_tcp_needed(const SendQueue::Event &event, int64_t now);
+
+  void event_delivered(
+    SendQueue::Event &event,
+    Latency &latency,
+    const char *name,
+    int64_t now);
+
+  Scheduler::Task connection_task();
+  Scheduler::Task sender_task();
+  Scheduler::Task udp_task();
   void control_run();
 
+  static void on_wake(void *context);
   static void *control_thread(void *context);
 
+  static const int CONNECT_TIMEOUT_MS = 1000;
+  static const int RETRY_DELAY_MIN_MS = 100;
+  static const int RETRY_DELAY_MAX_MS = 4000;
+  static const int SEND_BATCH = 8;
+  static const int SEND_TIMEOUT_MS = 200;
+
+  // UDP retransmits start at UDP_RETRY_MS and double each time. After
+  // UDP_MAX_ATTEMPTS the event is left to TCP, and after UDP_MAX_FAILURES
+  // events in a row without an ack UDP is considered blocked for
+  // UDP_BLOCKED_MS.
+  static const int UDP_RETRY_MS = 30;
+  static const int UDP_MAX_ATTEMPTS = 4;
+  static const int UDP_MAX_FAILURES = 3;
+  static const int UDP_BLOCKED_MS = 30000;
+
   pthread_t control_pid;
-  int socket_id;
+  pthread_mutex_t lock;
+
+  Reactor reactor;
+  Scheduler scheduler;
+  Scheduler::Signal link_changed;
+  Scheduler::Signal send_ready;
+  Cancel cancel;
+  SendQueue send_queue;
+  ClockSync clock;
+  Latency latency_tcp;
+  Latency latency_udp;
+  bool has_ip;
+  bool link_event;
+  bool drop_connection;
+  bool use_udp;
+  int retry_delay_ms;
+  int udp_failures;
+  int64_t udp_blocked_time;
+  uint16_t next_sequence;
+  uint16_t heartbeat_sequence;
+  int64_t last_heard;
+  uint8_t rx_buffer[64];
+  int rx_length;
+  SocketTransport tcp;
+  SocketTransport udp;
+  Transport *control;
+  Transport *datagram;
+  bool connected;
 };
 
 #endif
@@ -0,0 +1,84 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#include <string.h>
+
+#include "SendQueue.h"
+
+SendQueue::SendQueue() :
+  head    { 0 },
+  count   { 0 },
+  sent    { 0 },
+  dropped { 0 }
+{
+  memset(events, 0, sizeof(events));
+}
+
+SendQueue::~SendQueue()
+{
+}
+
+bool SendQueue::push(int player, uint16_t sequence, int64_t timestamp)
+{
+  // When full the new event is refused rather than overwriting the
+  // oldest, since the oldest one may be in the middle of being sent.
+  if (is_full())
+  {
+    dropped++;
+    return false;
+  }
+
+  Event &event = events[(head + count) % SIZE];
+  event.timestamp  = timestamp;
+  event.retry_time = timestamp;
+  event.sequence   = sequence;
+  event.player     = player;
+  event.attempts   = 0;
+  event.acked      = false;
+
+  count++;
+
+  return true;
+}
+
+SendQueue::Event *SendQueue::get(int index)
+{
+  // Index 0 is the oldest event.
+  if (index < 0 || index >= count) { return NULL; }
+
+  return &events[(head + index) % SIZE];
+}
+
+int SendQueue::pop_acked()
+{
+  int n = 0;
+
+  while (! is_empty() && events[head].acked)
+  {
+    pop();
+    n++;
+  }
+
+  return n;
+}
+
+void SendQueue::pop()
+{
+  if (is_empty()) { return; }
+
+  head = (head + 1) % SIZE;
+  count--;
+
+  if (sent > 0) { sent--; }
+}
+
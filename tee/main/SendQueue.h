@@ -0,0 +1,68 @@
+/**
+ *  MiniGolf
+ *  Author: Michael Kohn
+ *   Email: mike@mikekohn.net
+ *     Web: https://www.mikekohn.net/
+ * License: BSD
+ *
+ * Copyright 2025 by Michael Kohn
+ *
+ * https://www.mikekohn.net/
+ *
+ */
+
+#ifndef SEND_QUEUE_H
+#define SEND_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Bounded ring of outbound events. Events stay in the queue until the
+// base acknowledges them so a tap made while the link is down (or lost
+// with a dropped connection) is sent once the connection comes back.
+// The first "sent" events from the head have gone out on TCP. Events can
+// also be acked out of order over UDP, they are removed once everything
+// in front of them is acked too. Not thread safe, the owner has to hold
+// its own lock.
+class SendQueue
+{
+public:
+  SendQueue();
+  ~SendQueue();
+
+  struct Event
+  {
+    int64_t timestamp;
+    int64_t retry_time;
+    uint16_t sequence;
+    uint8_t player;
+    uint8_t attempts;
+    bool acked;
+  };
+
+  bool is_empty() { return count == 0; }
+  bool is_full()  { return count == SIZE; }
+  int get_count() { return count; }
+  int get_sent() { return sent; }
+  int get_dropped() { return dropped; }
+
+  bool push(int player, uint16_t sequence, int64_t timestamp);
+  Event *get(int index);
+  void mark_sent(int n) { sent += n; }
+  void resend_all() { sent = 0; }
+  int pop_acked();
+
+private:
+  void pop();
+
+  static const int SIZE = 32;
+
+  Event events[SIZE];
+  int head;
+  int count;
+  int sent;
+  int dropped;
+};
+
+#endif
+